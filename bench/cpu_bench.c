@@ -0,0 +1,460 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include "job.h"
+#include "emu.h"
+
+#include "lib/tamalib.h"
+
+/* Host-side benchmark of the cpu job, running the real TamaLIB with the
+ * given ROM against the real time. The job that steps TamaLIB one
+ * instruction at a time, checking the next job and the time after each
+ * of them, is compared with the emulation job of the firmware (emu.c,
+ * linked as is, with its batches and its HALT fast-forward), both at max
+ * speed (emulated instructions per second and speed factor) and at x1
+ * speed (share of the time spent awake and wakeups). A job mimicking the
+ * render one shares the queue, so that the batches are bounded the same
+ * way they are in the firmware. Then each speed level of the firmware is
+ * run with its frame skipping and its CPU share, reporting the achieved
+ * speed, the frames rendered and how late the render job got. Last, the
+ * CPU is reset while halted, as the menu does, checking that it does not
+ * resume from the tick counter it had before the reset, and an interrupt
+ * scheduling an ASAP job while the emulation runs at max speed is timed
+ * with the MCU time starting at 0 and past 2^31 ticks, checking that the
+ * emulation yields to that job the same way in both cases.
+ */
+
+#define RUN_DURATION					2000 //ms
+
+#define RENDER_JOB_PERIOD				33 //ms
+
+#define ASAP_RUN_DURATION				1000 //ms
+#define ASAP_IRQ_PERIOD					7 //ms
+#define ASAP_WRAP_TIME					0x80000000UL // MCU ticks, where the 32-bit differences change sign
+
+#define RESET_HALT_DURATION				2000 //ms, before the reset
+#define RESET_RUN_DURATION				500 //ms, after the reset
+
+typedef struct {
+	uint8_t ratio;
+	uint8_t frame_skip;
+	uint8_t cpu_share;
+	char *name;
+} speed_level_t;
+
+/* Same as in main.c */
+static const speed_level_t speed_levels[] = {
+	{1,	0,	100,	"x1"},
+	{2,	0,	100,	"x2"},
+	{4,	1,	90,	"x4"},
+	{8,	2,	85,	"x8"},
+	{0,	3,	80,	"max"},
+};
+
+/* Without frame skipping nor CPU share, to compare the cpu jobs */
+static const speed_level_t unbounded_levels[] = {
+	{1,	0,	100,	"x1"},
+	{0,	0,	100,	"max"},
+};
+
+#define SPEED_LEVEL_NUM					(sizeof(speed_levels)/sizeof(speed_levels[0]))
+
+#define NS_TO_MCU_TIME(t)				(((t) * MCU_TIME_FREQ_NUM)/(MCU_TIME_FREQ_DEN * 1000ULL))
+
+static u12_t program[4096];
+
+static uint64_t start_ns;
+static mcu_time_t start_time; // MCU time at start_ns
+static mcu_time_t wakeup_time;
+static jmp_buf end_jmp;
+
+static bool_t tamalib_is_late = 0;
+
+static const speed_level_t *speed_level;
+
+static uint64_t steps_total;
+static uint64_t ticks_total;
+static u32_t ticks_last;
+static uint64_t sleep_ns;
+static uint32_t wakeups;
+static uint32_t frames;
+static mcu_time_t render_late_max;
+
+static bool_t irq_enabled = 0;
+static mcu_time_t irq_time;
+static mcu_time_t irq_raised;
+static mcu_time_t irq_late_max;
+
+static job_t step_job;
+static job_t render_job;
+static job_t irq_job;
+static job_t end_job;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Stubs of the MCU layer */
+void system_disable_irq(void) {}
+void system_enable_irq(void) {}
+void system_fatal_error(void) { fprintf(stderr, "Job queue overflow !\n"); exit(1); }
+exec_state_t system_get_max_state(void) { return HIGHEST_ALLOWED_STATE; }
+
+mcu_time_t time_get(void)
+{
+	return start_time + (mcu_time_t) NS_TO_MCU_TIME(now_ns() - start_ns);
+}
+
+void time_wait_until(mcu_time_t time)
+{
+	while ((int32_t) (time - time_get()) > 0);
+}
+
+exec_state_t time_configure_wakeup(mcu_time_t time)
+{
+	wakeup_time = time;
+
+	return ((int32_t) (time - time_get()) > 0) ? STATE_SLEEP_S1 : STATE_RUN;
+}
+
+void system_enter_state(exec_state_t state)
+{
+	struct timespec ts = {0, 0};
+	int32_t delta = wakeup_time - time_get();
+	uint64_t start = now_ns();
+
+	wakeups++;
+
+	if (delta > 0) {
+		ts.tv_nsec = (delta * MCU_TIME_FREQ_DEN * 1000ULL)/MCU_TIME_FREQ_NUM;
+		nanosleep(&ts, NULL);
+	}
+
+	sleep_ns += now_ns() - start;
+}
+
+static void irq_job_fn(job_t *job)
+{
+	mcu_time_t late = time_get() - irq_raised;
+
+	if (late > irq_late_max) {
+		irq_late_max = late;
+	}
+}
+
+/* emu.c is built with its TamaLIB steps routed here */
+void bench_step(void)
+{
+	tamalib_step();
+	steps_total++;
+
+	/* An interrupt handler scheduling a job while a batch of steps runs */
+	if (irq_enabled && (int32_t) (time_get() - irq_time) >= 0) {
+		irq_time += MS_TO_MCU_TIME(ASAP_IRQ_PERIOD);
+		irq_raised = time_get();
+		job_schedule(&irq_job, &irq_job_fn, JOB_ASAP);
+	}
+}
+
+/* TamaLIB HAL */
+static void * hal_malloc(u32_t size) { return NULL; }
+static void hal_free(void *ptr) {}
+static void hal_halt(void) {}
+static bool_t hal_is_log_enabled(log_level_t level) { return 0; }
+static void hal_log(log_level_t level, char *buff, ...) {}
+static void hal_update_screen(void) {}
+static void hal_set_lcd_matrix(u8_t x, u8_t y, bool_t val) {}
+static void hal_set_lcd_icon(u8_t icon, bool_t val) {}
+static void hal_set_frequency(u32_t freq) {}
+static void hal_play_frequency(bool_t en) {}
+static int hal_handler(void) { return 0; }
+
+static void hal_sleep_until(timestamp_t ts)
+{
+	/* The step job relies on the same notification as the emulation job */
+	if ((int32_t) (ts - emu_get_timestamp()) > 0) {
+		tamalib_is_late = 0;
+	}
+
+	emu_sleep_until(ts);
+}
+
+static hal_t hal = {
+	.malloc = &hal_malloc,
+	.free = &hal_free,
+	.halt = &hal_halt,
+	.is_log_enabled = &hal_is_log_enabled,
+	.log = &hal_log,
+	.sleep_until = &hal_sleep_until,
+	.get_timestamp = &emu_get_timestamp,
+	.update_screen = &hal_update_screen,
+	.set_lcd_matrix = &hal_set_lcd_matrix,
+	.set_lcd_icon = &hal_set_lcd_icon,
+	.set_frequency = &hal_set_frequency,
+	.play_frequency = &hal_play_frequency,
+	.handler = &hal_handler,
+};
+
+/* The previous cpu job */
+static void step_job_fn(job_t *job)
+{
+	job_t *next_job;
+
+	job_schedule_next(&step_job, MS_TO_MCU_TIME(EMU_JOB_PERIOD));
+
+	tamalib_is_late = 1;
+
+	while (tamalib_is_late) {
+		bench_step();
+
+		next_job = job_get_next();
+		if (next_job != NULL && next_job->time <= time_get()) {
+			job_schedule(&step_job, &step_job_fn, next_job->time);
+			break;
+		}
+	}
+}
+
+static void sample_ticks(void)
+{
+	u32_t ticks = *(tamalib_get_state()->tick_counter);
+
+	/* The tick counter wraps in less than a second at max speed */
+	ticks_total += ticks - ticks_last;
+	ticks_last = ticks;
+}
+
+static void render_job_fn(job_t *job)
+{
+	mcu_time_t late = time_get() - job->time;
+
+	if (late > render_late_max) {
+		render_late_max = late;
+	}
+
+	job_schedule_next(&render_job, MS_TO_MCU_TIME(RENDER_JOB_PERIOD) * (speed_level->frame_skip + 1));
+
+	sample_ticks();
+	frames++;
+}
+
+static void end_job_fn(job_t *job)
+{
+	sample_ticks();
+
+	longjmp(end_jmp, 1);
+}
+
+static int load_rom(const char *path)
+{
+	FILE *f;
+	uint8_t buf[2];
+	uint32_t i = 0;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		return -1;
+	}
+
+	/* Same format as the ROM files loaded by the firmware */
+	while (i < sizeof(program)/sizeof(program[0]) && fread(buf, 1, 2, f) == 2) {
+		program[i++] = buf[1] | ((buf[0] & 0xF) << 8);
+	}
+
+	fclose(f);
+
+	return (i > 0) ? 0 : -1;
+}
+
+static void run_until(mcu_time_t time)
+{
+	job_schedule(&end_job, &end_job_fn, time);
+
+	if (!setjmp(end_jmp)) {
+		job_mainloop();
+	}
+}
+
+static void run(const char *name, bool_t step, const speed_level_t *level)
+{
+	uint64_t total_ns;
+
+	job_cancel(&step_job);
+	job_cancel(&render_job);
+	job_cancel(&end_job);
+	emu_stop();
+
+	steps_total = 0;
+	ticks_total = 0;
+	sleep_ns = 0;
+	wakeups = 0;
+	frames = 0;
+	render_late_max = 0;
+	speed_level = level;
+	start_ns = now_ns();
+
+	if (emu_init(program, NULL)) {
+		fprintf(stderr, "Cannot initialize TamaLIB !\n");
+		exit(1);
+	}
+
+	emu_set_speed(level->ratio, level->cpu_share);
+	ticks_last = *(tamalib_get_state()->tick_counter);
+
+	if (step) {
+		job_schedule(&step_job, &step_job_fn, JOB_ASAP);
+	} else {
+		emu_start();
+	}
+
+	job_schedule(&render_job, &render_job_fn, time_get() + MS_TO_MCU_TIME(RENDER_JOB_PERIOD));
+	run_until(time_get() + MS_TO_MCU_TIME(RUN_DURATION));
+
+	total_ns = now_ns() - start_ns;
+
+	tamalib_release();
+
+	printf("%s\t%s\t%.0f\t%.2f\t%.2f\t%.1f\t%.1f\t%.1f\n", name, level->name, (double) steps_total * 1000/RUN_DURATION,
+		(double) ticks_total * 1000/RUN_DURATION/TAMALIB_FREQ, (double) (total_ns - sleep_ns) * 100/total_ns,
+		(double) wakeups * 1000/RUN_DURATION, (double) frames * 1000/RUN_DURATION,
+		(double) MCU_TIME_TO_US((uint64_t) render_late_max)/1000);
+}
+
+static int reset_halted(void)
+{
+	u32_t ticks, expected = ((uint64_t) RESET_RUN_DURATION * TAMALIB_FREQ)/1000;
+
+	job_cancel(&step_job);
+	job_cancel(&render_job);
+	job_cancel(&end_job);
+	emu_stop();
+
+	speed_level = &unbounded_levels[0];
+	start_ns = now_ns();
+
+	if (emu_init(program, NULL)) {
+		fprintf(stderr, "Cannot initialize TamaLIB !\n");
+		exit(1);
+	}
+
+	emu_set_speed(1, 100);
+	emu_start();
+
+	/* At x1, the CPU spends almost all its time halted between two jobs */
+	run_until(time_get() + MS_TO_MCU_TIME(RESET_HALT_DURATION));
+
+	emu_reset();
+	run_until(time_get() + MS_TO_MCU_TIME(RESET_RUN_DURATION));
+
+	ticks = *(tamalib_get_state()->tick_counter);
+
+	tamalib_release();
+
+	printf("reset while halted: %u ticks after %u ms (expected ~%u) %s\n", ticks, RESET_RUN_DURATION, expected,
+		(ticks <= 2 * expected) ? "OK" : "FAILED");
+
+	return (ticks <= 2 * expected) ? 0 : -1;
+}
+
+static mcu_time_t asap_late(mcu_time_t start)
+{
+	job_cancel(&step_job);
+	job_cancel(&render_job);
+	job_cancel(&end_job);
+	emu_stop();
+
+	speed_level = &speed_levels[SPEED_LEVEL_NUM - 1];
+	start_time = start;
+	start_ns = now_ns();
+	irq_late_max = 0;
+
+	if (emu_init(program, NULL)) {
+		fprintf(stderr, "Cannot initialize TamaLIB !\n");
+		exit(1);
+	}
+
+	emu_set_speed(speed_level->ratio, speed_level->cpu_share);
+	emu_start();
+
+	job_schedule(&render_job, &render_job_fn, time_get() + MS_TO_MCU_TIME(RENDER_JOB_PERIOD));
+
+	irq_time = time_get() + MS_TO_MCU_TIME(ASAP_IRQ_PERIOD);
+	irq_enabled = 1;
+	run_until(time_get() + MS_TO_MCU_TIME(ASAP_RUN_DURATION));
+	irq_enabled = 0;
+
+	job_cancel(&irq_job);
+	tamalib_release();
+	start_time = 0;
+
+	return irq_late_max;
+}
+
+static int asap_wrap(void)
+{
+	mcu_time_t low = asap_late(0);
+	mcu_time_t wrap = asap_late(ASAP_WRAP_TIME);
+	bool_t ok = (wrap <= 2 * low + MS_TO_MCU_TIME(1));
+
+	printf("asap job while running: %.1f ms late max from 0, %.1f ms past 2^31 ticks %s\n",
+		(double) MCU_TIME_TO_US((uint64_t) low)/1000, (double) MCU_TIME_TO_US((uint64_t) wrap)/1000, ok ? "OK" : "FAILED");
+
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t i;
+
+	if (argc < 2 || load_rom(argv[1]) < 0) {
+		fprintf(stderr, "Usage: %s <rom.bin>\n", argv[0]);
+		return 1;
+	}
+
+	tamalib_register_hal(&hal);
+
+	printf("config\tspeed\tsteps_per_s\temu_speed\tawake_pct\twakeups_per_s\tfps\trender_late_ms\n");
+
+	run("step", 1, &unbounded_levels[1]);
+	run("emu", 0, &unbounded_levels[1]);
+	run("step", 1, &unbounded_levels[0]);
+	run("emu", 0, &unbounded_levels[0]);
+
+	for (i = 0; i < SPEED_LEVEL_NUM; i++) {
+		run("level", 0, &speed_levels[i]);
+	}
+
+	if (reset_halted() < 0 || asap_wrap() < 0) {
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "lib/tamalib.h"
+
+/* Headless emulation throughput benchmark. The host firmware (main.c and
+ * its hal_t glue, the host MCU layer, FatFs and TamaLIB) runs at max speed
+ * from a fresh flash image holding the given ROM, and optionally the given
+ * state as autosave slot, until the requested emulated time is reached.
+ * main.c is built with its entry point renamed and with the TamaLIB HAL
+ * registration and steps routed through this file, so that the steps and
+ * the HAL callbacks can be counted. The result is a single tab-separated
+ * line, preceded by its header.
+ */
+
+#define TAMALIB_FREQ					32768 // Hz
+
+/* Emulated time left to the boot, mostly spent programming the imported files into the flash */
+#define BOOT_TIME_MAX					60 // s
+
+typedef enum {
+	CB_SLEEP_UNTIL = 0,
+	CB_GET_TIMESTAMP,
+	CB_UPDATE_SCREEN,
+	CB_SET_LCD_MATRIX,
+	CB_SET_LCD_ICON,
+	CB_SET_FREQUENCY,
+	CB_PLAY_FREQUENCY,
+	CB_HANDLER,
+	CB_OTHER,
+	CB_NUM,
+} cb_t;
+
+static const char *cb_names[CB_NUM] = {
+	"sleep_until",
+	"get_timestamp",
+	"update_screen",
+	"set_lcd_matrix",
+	"set_lcd_icon",
+	"set_frequency",
+	"play_frequency",
+	"handler",
+	"other",
+};
+
+static hal_t *fw_hal;
+static uint64_t cb_counts[CB_NUM];
+
+static uint64_t target_ticks;
+static uint64_t ticks_total;
+static u32_t ticks_last;
+static uint64_t steps;
+static uint64_t start_ns;
+static char flash_path[] = "/tmp/emu_bench_XXXXXX";
+
+int firmware_main(void);
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Counting wrappers of the firmware HAL */
+static void * hal_malloc(u32_t size) { cb_counts[CB_OTHER]++; return fw_hal->malloc(size); }
+static void hal_free(void *ptr) { cb_counts[CB_OTHER]++; fw_hal->free(ptr); }
+static void hal_halt(void) { cb_counts[CB_OTHER]++; fw_hal->halt(); }
+static bool_t hal_is_log_enabled(log_level_t level) { cb_counts[CB_OTHER]++; return fw_hal->is_log_enabled(level); }
+static void hal_sleep_until(timestamp_t ts) { cb_counts[CB_SLEEP_UNTIL]++; fw_hal->sleep_until(ts); }
+static timestamp_t hal_get_timestamp(void) { cb_counts[CB_GET_TIMESTAMP]++; return fw_hal->get_timestamp(); }
+static void hal_update_screen(void) { cb_counts[CB_UPDATE_SCREEN]++; fw_hal->update_screen(); }
+static void hal_set_lcd_matrix(u8_t x, u8_t y, bool_t val) { cb_counts[CB_SET_LCD_MATRIX]++; fw_hal->set_lcd_matrix(x, y, val); }
+static void hal_set_lcd_icon(u8_t icon, bool_t val) { cb_counts[CB_SET_LCD_ICON]++; fw_hal->set_lcd_icon(icon, val); }
+static void hal_set_frequency(u32_t freq) { cb_counts[CB_SET_FREQUENCY]++; fw_hal->set_frequency(freq); }
+static void hal_play_frequency(bool_t en) { cb_counts[CB_PLAY_FREQUENCY]++; fw_hal->play_frequency(en); }
+static int hal_handler(void) { cb_counts[CB_HANDLER]++; return fw_hal->handler(); }
+
+static void hal_log(log_level_t level, char *buff, ...)
+{
+	char str[256];
+	va_list args;
+
+	cb_counts[CB_OTHER]++;
+
+	va_start(args, buff);
+	vsnprintf(str, sizeof(str), buff, args);
+	va_end(args);
+
+	fw_hal->log(level, "%s", str);
+}
+
+static hal_t hal = {
+	.malloc = &hal_malloc,
+	.free = &hal_free,
+	.halt = &hal_halt,
+	.is_log_enabled = &hal_is_log_enabled,
+	.log = &hal_log,
+	.sleep_until = &hal_sleep_until,
+	.get_timestamp = &hal_get_timestamp,
+	.update_screen = &hal_update_screen,
+	.set_lcd_matrix = &hal_set_lcd_matrix,
+	.set_lcd_icon = &hal_set_lcd_icon,
+	.set_frequency = &hal_set_frequency,
+	.play_frequency = &hal_play_frequency,
+	.handler = &hal_handler,
+};
+
+/* Called by main.c instead of tamalib_register_hal() */
+void bench_register_hal(hal_t *h)
+{
+	fw_hal = h;
+	tamalib_register_hal(&hal);
+}
+
+/* Called by main.c instead of tamalib_step() */
+void bench_step(void)
+{
+	u32_t ticks = *(tamalib_get_state()->tick_counter);
+
+	/* The firmware may also move the tick counter between two steps (HALT) */
+	ticks_total += ticks - ticks_last;
+	ticks_last = ticks;
+
+	if (steps == 0) {
+		/* Boot is over */
+		ticks_total = 0;
+		start_ns = now_ns();
+	} else if (ticks_total >= target_ticks) {
+		exit(0);
+	}
+
+	tamalib_step();
+	steps++;
+}
+
+static void report(void)
+{
+	struct rusage usage;
+	double real_s = (double) (now_ns() - start_ns)/1000000000;
+	double emu_s = (double) ticks_total/TAMALIB_FREQ;
+	uint8_t i;
+
+	unlink(flash_path);
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("emu_s\treal_s\tsteps\tips\trt_factor\tpeak_rss_kb");
+	for (i = 0; i < CB_NUM; i++) {
+		printf("\t%s", cb_names[i]);
+	}
+	printf("\n");
+
+	printf("%.1f\t%.3f\t%llu\t%.0f\t%.1f\t%ld", emu_s, real_s, (unsigned long long) steps,
+		(real_s > 0) ? steps/real_s : 0, (real_s > 0) ? emu_s/real_s : 0, usage.ru_maxrss);
+	for (i = 0; i < CB_NUM; i++) {
+		printf("\t%llu", (unsigned long long) cb_counts[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	char import[512];
+	char duration[32];
+	unsigned long seconds;
+	int fd;
+
+	if (argc < 3 || (seconds = strtoul(argv[1], NULL, 0)) == 0) {
+		fprintf(stderr, "Usage: %s <emulated seconds> <rom.bin> [state.bin]\n", argv[0]);
+		return 1;
+	}
+
+	target_ticks = (uint64_t) seconds * TAMALIB_FREQ;
+
+	/* Always start from a fresh flash image */
+	fd = mkstemp(flash_path);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create the flash image !\n");
+		return 1;
+	}
+	close(fd);
+
+	if (argc > 3) {
+		snprintf(import, sizeof(import), "%s:rom0.bin,%s:save0.bin", argv[2], argv[3]);
+	} else {
+		snprintf(import, sizeof(import), "%s:rom0.bin", argv[2]);
+	}
+
+	/* Sleeps are skipped, and the run is stopped anyway if the emulation is slower than x1 */
+	snprintf(duration, sizeof(duration), "%lu", (seconds + BOOT_TIME_MAX) * 1000);
+
+	setenv("MCUGOTCHI_FLASH", flash_path, 1);
+	setenv("MCUGOTCHI_IMPORT", import, 1);
+	setenv("MCUGOTCHI_SPEED", "0", 1);
+	setenv("MCUGOTCHI_DURATION", duration, 1);
+	unsetenv("MCUGOTCHI_SCREEN");
+	unsetenv("MCUGOTCHI_INPUT");
+
+	atexit(&report);
+
+	start_ns = now_ns();
+
+	return firmware_main();
+}
@@ -0,0 +1,340 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "job.h"
+
+/* Host-side microbenchmark comparing the job queue with the sorted list
+ * it replaced. Each depth is filled with jobs using the periods of the
+ * firmware jobs, then the earliest job is repeatedly dequeued and
+ * rescheduled like job_mainloop() and the callbacks do, while random
+ * jobs are rescheduled the way input events do.
+ *
+ * Since both run with IRQs disabled, the cost of the worst case matters
+ * as much as the mean one: it is measured by pushing the earliest job,
+ * then the latest job, past all the others. This is the deepest walk of
+ * the list (insert, then cancel and insert at the tail) and the deepest
+ * sift of the heap.
+ *
+ * Last, the queue order is checked with an ASAP job and jobs due around
+ * the points where the 32-bit MCU time differences change sign (2^31
+ * ticks) and where the MCU time wraps (2^32 ticks).
+ */
+
+#define ITERATIONS					2000000
+
+typedef struct list_job {
+	mcu_time_t time;
+	void (*cb)(struct list_job *);
+	struct list_job *next;
+} list_job_t;
+
+static const uint32_t periods_ms[] = {
+	10,		// cpu
+	33,		// render
+	33,		// breathing
+	100,		// debounce
+	1000,		// long press
+	5000,		// backlight
+	30000,		// autooff
+	60000,		// battery
+	3600000,	// autosave
+};
+
+#define PERIODS_NUM					(sizeof(periods_ms)/sizeof(periods_ms[0]))
+
+static const uint8_t depths[] = {4, 8, 12, 16, 24, JOB_QUEUE_SIZE};
+
+#define DEPTHS_NUM					(sizeof(depths)/sizeof(depths[0]))
+
+static list_job_t *list_jobs = NULL;
+
+static list_job_t l_pool[JOB_QUEUE_SIZE];
+static job_t h_pool[JOB_QUEUE_SIZE];
+
+
+/* Stubs of the MCU layer */
+void system_disable_irq(void) {}
+void system_enable_irq(void) {}
+void system_fatal_error(void) { fprintf(stderr, "Job queue overflow !\n"); exit(1); }
+void system_enter_state(exec_state_t state) {}
+exec_state_t system_get_max_state(void) { return STATE_RUN; }
+mcu_time_t time_get(void) { return 0; }
+exec_state_t time_configure_wakeup(mcu_time_t time) { return STATE_RUN; }
+void time_wait_until(mcu_time_t time) {}
+
+/* The previous implementation */
+static __attribute__((noinline)) void list_cancel(list_job_t *job)
+{
+	list_job_t **j = &list_jobs;
+
+	while (*j != NULL) {
+		if (*j == job) {
+			*j = job->next;
+			break;
+		}
+
+		j = &((*j)->next);
+	}
+}
+
+static __attribute__((noinline)) void list_schedule(list_job_t *job, void (*cb)(list_job_t *), mcu_time_t time)
+{
+	list_job_t **j = &list_jobs;
+
+	list_cancel(job);
+
+	job->cb = cb;
+	job->time = time;
+
+	while (*j != NULL && (int32_t) (time - (*j)->time) >= 0) {
+		j = &((*j)->next);
+	}
+
+	job->next = *j;
+	*j = job;
+}
+
+static void list_cb(list_job_t *job) {}
+static void heap_cb(job_t *job) {}
+
+static uint32_t rand_next(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double bench_list(uint8_t depth)
+{
+	uint32_t seed = depth;
+	mcu_time_t now = 0;
+	list_job_t *j;
+	uint64_t start;
+	uint32_t i, r;
+
+	list_jobs = NULL;
+
+	for (i = 0; i < depth; i++) {
+		list_schedule(&l_pool[i], &list_cb, now + MS_TO_MCU_TIME(periods_ms[i % PERIODS_NUM]));
+	}
+
+	start = now_ns();
+
+	for (i = 0; i < ITERATIONS; i++) {
+		/* Dispatch the earliest job, which reschedules itself */
+		j = list_jobs;
+		list_jobs = j->next;
+		now = j->time;
+		list_schedule(j, &list_cb, now + MS_TO_MCU_TIME(periods_ms[(j - l_pool) % PERIODS_NUM]));
+
+		/* Input-like activity */
+		r = rand_next(&seed);
+		if ((r & 0x7) == 0) {
+			j = &l_pool[r % depth];
+			list_schedule(j, &list_cb, now + MS_TO_MCU_TIME(periods_ms[r % PERIODS_NUM]));
+		}
+	}
+
+	return (double) (now_ns() - start)/ITERATIONS;
+}
+
+static double bench_list_worst(uint8_t depth)
+{
+	mcu_time_t last = 0;
+	list_job_t *j;
+	uint64_t start, first_ns, last_ns;
+	uint32_t i;
+
+	list_jobs = NULL;
+
+	for (i = 0; i < depth; i++) {
+		list_schedule(&l_pool[i], &list_cb, MS_TO_MCU_TIME(periods_ms[i % PERIODS_NUM]));
+	}
+
+	for (j = list_jobs; j != NULL; j = j->next) {
+		last = j->time;
+	}
+
+	start = now_ns();
+
+	/* The earliest job goes last */
+	for (i = 0; i < ITERATIONS; i++) {
+		list_schedule(list_jobs, &list_cb, ++last);
+	}
+
+	first_ns = now_ns() - start;
+
+	/* The job found last goes even further */
+	for (j = list_jobs; j->next != NULL; j = j->next);
+
+	start = now_ns();
+
+	for (i = 0; i < ITERATIONS; i++) {
+		list_schedule(j, &list_cb, ++last);
+	}
+
+	last_ns = now_ns() - start;
+
+	return (double) ((first_ns > last_ns) ? first_ns : last_ns)/ITERATIONS;
+}
+
+static double bench_heap(uint8_t depth)
+{
+	uint32_t seed = depth;
+	mcu_time_t now = 0;
+	job_t *j;
+	uint64_t start;
+	uint32_t i, r;
+
+	for (i = 0; i < JOB_QUEUE_SIZE; i++) {
+		job_cancel(&h_pool[i]);
+	}
+
+	for (i = 0; i < depth; i++) {
+		job_schedule(&h_pool[i], &heap_cb, now + MS_TO_MCU_TIME(periods_ms[i % PERIODS_NUM]));
+	}
+
+	start = now_ns();
+
+	for (i = 0; i < ITERATIONS; i++) {
+		/* Dispatch the earliest job, which reschedules itself */
+		j = job_get_next();
+		job_cancel(j);
+		now = j->time;
+		job_schedule(j, &heap_cb, now + MS_TO_MCU_TIME(periods_ms[(j - h_pool) % PERIODS_NUM]));
+
+		/* Input-like activity */
+		r = rand_next(&seed);
+		if ((r & 0x7) == 0) {
+			j = &h_pool[r % depth];
+			job_schedule(j, &heap_cb, now + MS_TO_MCU_TIME(periods_ms[r % PERIODS_NUM]));
+		}
+	}
+
+	return (double) (now_ns() - start)/ITERATIONS;
+}
+
+static double bench_heap_worst(uint8_t depth)
+{
+	mcu_time_t last = 0;
+	job_t *j = NULL;
+	uint64_t start, first_ns, last_ns;
+	uint32_t i;
+
+	for (i = 0; i < JOB_QUEUE_SIZE; i++) {
+		job_cancel(&h_pool[i]);
+	}
+
+	for (i = 0; i < depth; i++) {
+		job_schedule(&h_pool[i], &heap_cb, MS_TO_MCU_TIME(periods_ms[i % PERIODS_NUM]));
+
+		if ((int32_t) (h_pool[i].time - last) > 0) {
+			last = h_pool[i].time;
+		}
+	}
+
+	start = now_ns();
+
+	/* The earliest job goes last */
+	for (i = 0; i < ITERATIONS; i++) {
+		j = job_get_next();
+		job_schedule(j, &heap_cb, ++last);
+	}
+
+	first_ns = now_ns() - start;
+
+	/* The job moved last goes even further */
+	start = now_ns();
+
+	for (i = 0; i < ITERATIONS; i++) {
+		job_schedule(j, &heap_cb, ++last);
+	}
+
+	last_ns = now_ns() - start;
+
+	return (double) ((first_ns > last_ns) ? first_ns : last_ns)/ITERATIONS;
+}
+
+static int check_wrap_order(mcu_time_t base)
+{
+	/* Scheduling order, and the order they must run in */
+	static const int32_t offsets[] = {16, -256, 1, -16, 4096}; // Never 0, which is JOB_ASAP at the wrap
+	static const uint8_t expected[] = {5, 1, 3, 2, 0, 4};
+	static job_t wrap_jobs[6];
+	uint8_t i;
+	int ret = 0;
+
+	for (i = 0; i < JOB_QUEUE_SIZE; i++) {
+		job_cancel(&h_pool[i]);
+	}
+
+	for (i = 0; i < 5; i++) {
+		job_schedule(&wrap_jobs[i], &heap_cb, base + offsets[i]);
+	}
+
+	job_schedule(&wrap_jobs[5], &heap_cb, JOB_ASAP);
+
+	for (i = 0; i < 6; i++) {
+		if (job_get_next() != &wrap_jobs[expected[i]]) {
+			ret = -1;
+		}
+
+		job_cancel(job_get_next());
+	}
+
+	printf("order around 0x%08lX: %s\n", (unsigned long) base, (ret == 0) ? "OK" : "FAILED");
+
+	return ret;
+}
+
+int main(void)
+{
+	double l, h, lw, hw;
+	uint8_t i;
+
+	printf("depth\tlist_ns\theap_ns\tspeedup\tlist_worst_ns\theap_worst_ns\tworst_speedup\n");
+
+	for (i = 0; i < DEPTHS_NUM; i++) {
+		l = bench_list(depths[i]);
+		h = bench_heap(depths[i]);
+		lw = bench_list_worst(depths[i]);
+		hw = bench_heap_worst(depths[i]);
+
+		printf("%u\t%.1f\t%.1f\t%.2f\t%.1f\t%.1f\t%.2f\n", depths[i], l, h, l/h, lw, hw, lw/hw);
+	}
+
+	if (check_wrap_order(0x80000000UL) < 0 || check_wrap_order(0x00000000UL) < 0) {
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "gfx.h"
+
+/* Host-side microbenchmark of the drawing of the emulated LCD into the
+ * framebuffer, comparing the per-pixel gfx_square() loop with the
+ * column blitter, and with tamalib_screen() picking one of them from the
+ * number of lit pixels per column, for an empty, a sparse, a typical, a
+ * dense and a full screen. All must produce the same framebuffer. A frame whose
+ * overlay only changed is timed when drawn from scratch and when drawn on
+ * top of the cached LCD layer. The drawing of a menu page and of the
+ * "Please Wait" screen is timed as well. The time per frame is given in ns
+ * and in TSC cycles when available.
+ */
+
+#define LOOPS						20000
+
+/* Same as in main.c */
+#define LCD_WIDTH					32
+#define LCD_HEIGHT					16
+#define PIXEL_SIZE					3
+#define LCD_OFFET_X					16
+#define LCD_OFFET_Y					8
+#define PAUSED_X					34
+#define PAUSED_Y					24
+#define PAUSED_STR					"Paused"
+
+#define SCALE_BIT(n, b)					((((n) >> (b)) & 0x1) ? (((1UL << PIXEL_SIZE) - 1) << ((b) * PIXEL_SIZE)) : 0)
+#define SCALE_NIBBLE(n)					(SCALE_BIT(n, 0) | SCALE_BIT(n, 1) | SCALE_BIT(n, 2) | SCALE_BIT(n, 3))
+#define LCD_COLUMN_MIN_DOTS				5 // Host value, see the Makefile
+
+static const uint32_t scale_lut[16] = {
+	SCALE_NIBBLE(0), SCALE_NIBBLE(1), SCALE_NIBBLE(2), SCALE_NIBBLE(3),
+	SCALE_NIBBLE(4), SCALE_NIBBLE(5), SCALE_NIBBLE(6), SCALE_NIBBLE(7),
+	SCALE_NIBBLE(8), SCALE_NIBBLE(9), SCALE_NIBBLE(10), SCALE_NIBBLE(11),
+	SCALE_NIBBLE(12), SCALE_NIBBLE(13), SCALE_NIBBLE(14), SCALE_NIBBLE(15),
+};
+static const uint8_t nibble_dots[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+static uint32_t matrix_buffer[LCD_HEIGHT];
+
+static uint8_t lcd_layer[GFX_LAYER_SIZE];
+
+static uint8_t captured[DISPLAY_HEIGHT >> 3][DISPLAY_WIDTH];
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void capture_window(uint8_t *data, uint8_t page, uint8_t col_start, uint8_t col_end)
+{
+	memcpy(&captured[page][col_start], data, col_end - col_start + 1);
+}
+
+/* The sparse path of tamalib_screen() */
+static void square_screen(void)
+{
+	uint8_t i, j;
+	uint32_t row;
+
+	for (j = 0; j < LCD_HEIGHT; j++) {
+		for (row = matrix_buffer[j]; row != 0; row &= row - 1) {
+			i = __builtin_ctz(row);
+			gfx_square(i * PIXEL_SIZE + LCD_OFFET_X, j * PIXEL_SIZE + LCD_OFFET_Y, PIXEL_SIZE, PIXEL_SIZE, COLOR_ON_BLACK);
+		}
+	}
+}
+
+/* The dense path of tamalib_screen() */
+static void lut_screen(void)
+{
+	uint8_t i, j;
+	uint32_t used = 0;
+	uint16_t col;
+	uint64_t bits;
+
+	for (j = 0; j < LCD_HEIGHT; j++) {
+		used |= matrix_buffer[j];
+	}
+
+	for (; used != 0; used &= used - 1) {
+		i = __builtin_ctz(used);
+
+		col = 0;
+		for (j = 0; j < LCD_HEIGHT; j++) {
+			col |= ((matrix_buffer[j] >> i) & 0x1) << j;
+		}
+
+		bits = 0;
+		for (j = 0; j < LCD_HEIGHT; j += 4) {
+			bits |= (uint64_t) scale_lut[(col >> j) & 0xF] << (j * PIXEL_SIZE);
+		}
+
+		gfx_column(i * PIXEL_SIZE + LCD_OFFET_X, LCD_OFFET_Y, bits, PIXEL_SIZE);
+	}
+}
+
+static uint8_t count_dots(uint32_t row)
+{
+	uint8_t dots = 0;
+
+	for (; row != 0; row >>= 4) {
+		dots += nibble_dots[row & 0xF];
+	}
+
+	return dots;
+}
+
+/* The current tamalib_screen() with LCD_COLUMN_MIN_DOTS defined */
+static void auto_screen(void)
+{
+	uint8_t j;
+	uint32_t used = 0;
+	uint16_t dots = 0;
+
+	for (j = 0; j < LCD_HEIGHT; j++) {
+		used |= matrix_buffer[j];
+		dots += count_dots(matrix_buffer[j]);
+	}
+
+	if (dots < count_dots(used) * LCD_COLUMN_MIN_DOTS) {
+		square_screen();
+	} else {
+		lut_screen();
+	}
+}
+
+/* The LCD drawn again under the overlay */
+static void overlay_full(void)
+{
+	auto_screen();
+	gfx_string(PAUSED_STR, PAUSED_X, PAUSED_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
+}
+
+/* The overlay drawn on top of the cached LCD layer, as in render_job_fn() */
+static void overlay_layer(void)
+{
+	gfx_copy_layer(lcd_layer);
+	gfx_string(PAUSED_STR, PAUSED_X, PAUSED_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
+}
+
+/* Same as menu_draw() with the second item selected */
+static void menu_screen(void)
+{
+	static char *items[] = {"Speed [x1]", "Sound  ON", "Backlight", "Settings"};
+	uint8_t i, x;
+
+	gfx_square(0, 16, DISPLAY_WIDTH, 16, COLOR_ON_BLACK);
+
+	for (i = 0; i < 4; i++) {
+		x = gfx_string(items[i], 1, i * 16 + 1, 1, (i == 1) ? COLOR_OFF_WHITE : COLOR_ON_BLACK, BACKGROUND_OFF);
+		gfx_string(" >", x, i * 16 + 1, 1, (i == 1) ? COLOR_OFF_WHITE : COLOR_ON_BLACK, BACKGROUND_OFF);
+	}
+}
+
+/* Same as please_wait() */
+static void wait_screen(void)
+{
+	gfx_string("Please Wait", 9, 24, 1, COLOR_ON_BLACK, BACKGROUND_ON);
+}
+
+static void draw(void (*fn)(void), uint8_t *fb_copy)
+{
+	gfx_clear();
+	fn();
+
+	/* Registering the display again makes the next frame a full one */
+	gfx_register_display(&capture_window, 0);
+	gfx_print_screen();
+	memcpy(fb_copy, captured, sizeof(captured));
+}
+
+static void run(const char *name, const char *screen, void (*fn)(void))
+{
+	uint64_t start_ns, start_cycles;
+	uint32_t i;
+
+	start_cycles = now_cycles();
+	start_ns = now_ns();
+
+	for (i = 0; i < LOOPS; i++) {
+		gfx_clear();
+		fn();
+	}
+
+	printf("%s\t%s\t%.0f\t%.0f\n", name, screen, (double) (now_ns() - start_ns)/LOOPS, (double) (now_cycles() - start_cycles)/LOOPS);
+}
+
+static void fill(uint8_t percent)
+{
+	uint8_t i, j;
+
+	srand(1);
+
+	for (j = 0; j < LCD_HEIGHT; j++) {
+		matrix_buffer[j] = 0;
+		for (i = 0; i < LCD_WIDTH; i++) {
+			if ((rand() % 100) < percent) {
+				matrix_buffer[j] |= (1UL << i);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		uint8_t percent;
+	} screens[] = {
+		{"empty", 0},
+		{"sparse", 10},
+		{"typical", 25},
+		{"dense", 50},
+		{"full", 100},
+	};
+	uint8_t fb_square[sizeof(captured)], fb_lut[sizeof(captured)], fb_auto[sizeof(captured)], fb_layer[sizeof(captured)];
+	uint8_t i;
+
+	printf("blitter\tscreen\tns_per_frame\tcycles_per_frame\n");
+
+	for (i = 0; i < sizeof(screens)/sizeof(screens[0]); i++) {
+		fill(screens[i].percent);
+
+		draw(&square_screen, fb_square);
+		draw(&lut_screen, fb_lut);
+		draw(&auto_screen, fb_auto);
+		if (memcmp(fb_square, fb_lut, sizeof(captured)) || memcmp(fb_square, fb_auto, sizeof(captured))) {
+			fprintf(stderr, "The blitters do not draw the same %s screen !\n", screens[i].name);
+			return 1;
+		}
+
+		run("square", screens[i].name, &square_screen);
+		run("lut", screens[i].name, &lut_screen);
+		run("auto", screens[i].name, &auto_screen);
+	}
+
+	fill(25);
+
+	gfx_set_layer(lcd_layer);
+	gfx_clear();
+	auto_screen();
+	gfx_set_layer(NULL);
+
+	draw(&overlay_full, fb_lut);
+	draw(&overlay_layer, fb_layer);
+	if (memcmp(fb_lut, fb_layer, sizeof(captured))) {
+		fprintf(stderr, "The cached LCD layer does not give the same frame !\n");
+		return 1;
+	}
+
+	run("full", "overlay", &overlay_full);
+	run("layer", "overlay", &overlay_layer);
+
+	run("text", "menu", &menu_screen);
+	run("text", "please_wait", &wait_screen);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include "job.h"
+
+/* Host-side simulation of an idle minute, running the real job_mainloop()
+ * against a virtual clock. The firmware jobs active when idling (emulation,
+ * rendering and battery monitoring) are modelled by their period, their
+ * slack and an estimated runtime. The sleep states are entered the same
+ * way the STM32L0 does, with their enter and exit latencies.
+ */
+
+#define IDLE_DURATION					60000 //ms
+
+typedef struct {
+	const char *name;
+	uint32_t period; // ms
+	uint32_t slack; // ms
+	uint32_t cost; // us
+	job_t job;
+} sim_job_t;
+
+static sim_job_t sim_jobs[] = {
+	{"cpu",		10,		2,	1000},
+	{"render",	33,		10,	3000},
+	{"batt",	60000,		1000,	200},
+	{"asave",	3600000,	60000,	50000},
+};
+
+#define SIM_JOBS_NUM					(sizeof(sim_jobs)/sizeof(sim_jobs[0]))
+
+static mcu_time_t now = 0;
+static mcu_time_t end;
+static jmp_buf end_jmp;
+
+static uint32_t wakeups;
+static mcu_time_t residency[STATE_NUM];
+static mcu_time_t wakeup_time;
+
+
+/* Stubs of the MCU layer */
+void system_disable_irq(void) {}
+void system_enable_irq(void) {}
+void system_fatal_error(void) { fprintf(stderr, "Job queue overflow !\n"); longjmp(end_jmp, 1); }
+exec_state_t system_get_max_state(void) { return HIGHEST_ALLOWED_STATE; }
+
+mcu_time_t time_get(void)
+{
+	return now;
+}
+
+void time_wait_until(mcu_time_t time)
+{
+	if ((int32_t) (time - now) > 0) {
+		now = time;
+	}
+}
+
+exec_state_t time_configure_wakeup(mcu_time_t time)
+{
+	int32_t delta = time - now;
+
+	wakeup_time = time;
+
+	if (delta < SLEEP_S1_THRESHOLD) {
+		return STATE_RUN;
+	} else if (delta < SLEEP_S2_THRESHOLD) {
+		return STATE_SLEEP_S1;
+	} else if (delta < SLEEP_S3_THRESHOLD) {
+		return STATE_SLEEP_S2;
+	}
+
+	return STATE_SLEEP_S3;
+}
+
+void system_enter_state(exec_state_t state)
+{
+	static const mcu_time_t latencies[STATE_NUM] = {
+		0,
+		SLEEP_S1_THRESHOLD,
+		SLEEP_S2_THRESHOLD,
+		SLEEP_S3_THRESHOLD,
+	};
+
+	/* The CPU is only asleep between the enter and exit latencies */
+	residency[state] += wakeup_time - now - latencies[state];
+	now = wakeup_time;
+	wakeups++;
+}
+
+static void sim_job_fn(job_t *job)
+{
+	sim_job_t *j = (sim_job_t *) ((char *) job - offsetof(sim_job_t, job));
+
+	/* Same pattern as the firmware jobs */
+	job_schedule_next(job, MS_TO_MCU_TIME(j->period));
+
+	now += US_TO_MCU_TIME(j->cost);
+
+	if ((int32_t) (now - end) >= 0) {
+		longjmp(end_jmp, 1);
+	}
+}
+
+static void simulate(uint8_t with_slack)
+{
+	mcu_time_t start = now;
+	uint8_t i;
+
+	wakeups = 0;
+	for (i = 0; i < STATE_NUM; i++) {
+		residency[i] = 0;
+	}
+
+	for (i = 0; i < SIM_JOBS_NUM; i++) {
+		job_cancel(&(sim_jobs[i].job));
+		job_set_slack(&(sim_jobs[i].job), with_slack ? MS_TO_MCU_TIME(sim_jobs[i].slack) : 0);
+		job_schedule(&(sim_jobs[i].job), &sim_job_fn, now + MS_TO_MCU_TIME(sim_jobs[i].period));
+	}
+
+	end = now + MS_TO_MCU_TIME(IDLE_DURATION);
+
+	if (!setjmp(end_jmp)) {
+		job_mainloop();
+	}
+
+	printf("%s\t%.1f", with_slack ? "slack" : "exact", (double) wakeups * 1000/IDLE_DURATION);
+	for (i = STATE_SLEEP_S1; i < STATE_NUM; i++) {
+		printf("\t%.2f", (double) residency[i] * 100/(now - start));
+	}
+	printf("\n");
+}
+
+int main(void)
+{
+	printf("config\twakeups_per_s\ts1_pct\ts2_pct\ts3_pct\n");
+
+	simulate(0);
+	simulate(1);
+
+	return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+
+#include "job.h"
+#include "time.h"
+#include "emu.h"
+
+#include "lib/tamalib.h"
+
+/* TamaLIB steps are executed by batches sized from the time left before the next job,
+ * using an estimation of the number of steps executed per MCU tick (fixed point)
+ */
+#define CPU_RATE_SHIFT					8
+#define CPU_RATE_INIT					(8 << CPU_RATE_SHIFT) // steps/tick
+#define CPU_RATE_MAX					(4096 << CPU_RATE_SHIFT) // steps/tick
+#define CPU_RATE_MIN_TIME				8 // ticks, shorter runs are not accurate enough
+
+static const volatile u12_t *g_program;
+static void (*halt_cb)(void) = NULL;
+
+static uint16_t time_shift = 0;
+
+static bool_t tamalib_is_late = 0;
+
+static bool_t cpu_running = 0;
+static mcu_time_t cpu_time; // Time provided to TamaLIB while the cpu job is running
+static uint32_t cpu_rate = CPU_RATE_INIT;
+
+static timestamp_t tamalib_ts; // Time TamaLIB is at, as of its last step
+static bool_t cpu_halted = 0;
+static timestamp_t halt_ts;
+static u32_t halt_tick;
+
+static uint8_t speed_ratio = 1;
+static uint8_t speed_cpu_share = 100; // % of each EMU_JOB_PERIOD the cpu job is allowed to use
+static bool_t emulation_paused = 0;
+
+static job_t cpu_job;
+
+static void cpu_job_fn(job_t *job);
+
+
+timestamp_t emu_get_timestamp(void)
+{
+	/* While the cpu job is running, the time is only sampled between two batches of steps */
+	return (timestamp_t) ((cpu_running ? cpu_time : time_get()) << time_shift);
+}
+
+void emu_sleep_until(timestamp_t ts)
+{
+	tamalib_ts = ts;
+
+	/* Since TamaLIB is always late in implementations without mainloop,
+	 * notify the cpu job that TamaLIB catched up instead of waiting
+	 */
+	if ((int32_t) (ts - emu_get_timestamp()) > 0) {
+		tamalib_is_late = 0;
+	}
+}
+
+u32_t emu_get_next_int_tick(state_t *state)
+{
+	u32_t next = *(state->clk_timer_timestamp) + CLK_TIMER_PERIOD;
+	u32_t prog;
+
+	/* The programmable timer interrupt is generated when its counter reaches 0 */
+	if (*(state->prog_timer_enabled)) {
+		prog = *(state->prog_timer_timestamp) + (*(state->prog_timer_data) ? *(state->prog_timer_data) : 256) * PROG_TIMER_PERIOD;
+		if ((int32_t) (prog - next) < 0) {
+			next = prog;
+		}
+	}
+
+	return next;
+}
+
+static void cpu_resume(mcu_time_t time)
+{
+	state_t *state = tamalib_get_state();
+	int32_t delta = (timestamp_t) (time << time_shift) - halt_ts;
+
+	/* The CPU did nothing but waiting since it halted, so only the ticks need to catch up.
+	 * It is woken up at the latest by the next clock timer tick, one second away, and
+	 * before the cpu job is stopped or paused, so the delta is far from wrapping.
+	 */
+	if (delta > 0) {
+		*(state->tick_counter) = halt_tick + ((uint64_t) delta * TAMALIB_FREQ * 1000 * speed_ratio)/(MCU_TIME_FREQ_X1000 << time_shift);
+		cpu_sync_ref_timestamp();
+	}
+
+	job_set_slack(&cpu_job, MS_TO_MCU_TIME(EMU_JOB_SLACK));
+	cpu_halted = 0;
+}
+
+static void cpu_halt(state_t *state)
+{
+	int32_t ticks = emu_get_next_int_tick(state) - *(state->tick_counter);
+	int32_t delta;
+
+	if (ticks <= 0) {
+		return;
+	}
+
+	halt_ts = tamalib_ts;
+	halt_tick = *(state->tick_counter);
+
+	/* Time between now and the next interrupt, which is the only way out of HALT */
+	delta = halt_ts - (timestamp_t) (cpu_time << time_shift);
+	delta += ((uint64_t) ticks * (MCU_TIME_FREQ_X1000 << time_shift) + TAMALIB_FREQ * 1000 * speed_ratio - 1)/(TAMALIB_FREQ * 1000 * speed_ratio);
+
+	job_set_slack(&cpu_job, 0);
+	job_schedule(&cpu_job, &cpu_job_fn, cpu_time + ((delta + (1 << time_shift) - 1) >> time_shift));
+	cpu_halted = 1;
+}
+
+static void cpu_job_fn(job_t *job)
+{
+	job_t *next_job;
+	state_t *state = tamalib_get_state();
+	mcu_time_t start, budget_end;
+	int32_t remaining, budget;
+	uint32_t batch, n, steps = 0;
+	u13_t pc;
+	bool_t halted = 0;
+
+	job_schedule_next(&cpu_job, MS_TO_MCU_TIME(EMU_JOB_PERIOD));
+
+	tamalib_is_late = 1;
+	cpu_running = 1;
+	cpu_time = start = time_get();
+	budget_end = start + (MS_TO_MCU_TIME(EMU_JOB_PERIOD) * speed_cpu_share)/100;
+
+	if (cpu_halted) {
+		cpu_resume(cpu_time);
+	}
+
+	/* Execute all the missed steps at once, checking the next job and the time
+	 * only between two batches
+	 */
+	while (tamalib_is_late) {
+		next_job = job_get_next();
+		if (next_job == NULL) {
+			remaining = MS_TO_MCU_TIME(EMU_JOB_PERIOD);
+		} else if (next_job->time == JOB_ASAP) {
+			/* Already due, whatever the MCU time is */
+			remaining = 0;
+		} else {
+			remaining = (int32_t) (next_job->time - cpu_time);
+		}
+		if (remaining <= 0) {
+			/* No more time to execute instructions */
+			job_schedule(&cpu_job, &cpu_job_fn, next_job->time);
+			break;
+		}
+
+		budget = (int32_t) (budget_end - cpu_time);
+		if (budget <= 0) {
+			/* CPU share of the speed level used up, let the other jobs run */
+			if (speed_ratio > 1) {
+				/* Above x1, the speed is only a best effort, so do not accumulate
+				 * the time the MCU cannot keep up with
+				 */
+				cpu_sync_ref_timestamp();
+			}
+			break;
+		}
+
+		if (remaining > budget) {
+			remaining = budget;
+		}
+
+		/* Only aim at half of the remaining time, since the rate is an estimation */
+		batch = (remaining * cpu_rate) >> (CPU_RATE_SHIFT + 1);
+		if (batch == 0) {
+			batch = 1;
+		}
+
+		for (n = batch; n > 0 && tamalib_is_late; n--) {
+			pc = *(state->pc);
+			tamalib_step();
+
+			/* The PC does not move while the CPU is halted */
+			halted = (*(state->pc) == pc && g_program[(pc - 1) & PC_MASK] == HALT_OPCODE && !emulation_paused);
+			if (halted) {
+				/* The ROM waits for an interrupt, so it is done updating the LCD */
+				if (halt_cb != NULL) {
+					halt_cb();
+				}
+
+				if (speed_ratio == 0) {
+					/* Nothing can happen before the next interrupt, so jump to it */
+					*(state->tick_counter) = emu_get_next_int_tick(state);
+				}
+			}
+		}
+
+		steps += batch - n;
+
+		/* Keep the time TamaLIB caught up with */
+		if (tamalib_is_late) {
+			cpu_time = time_get();
+		}
+	}
+
+	cpu_running = 0;
+
+	if (halted && !tamalib_is_late && speed_ratio != 0) {
+		cpu_halt(state);
+	}
+
+	/* Refine the rate estimation using the runs that lasted long enough */
+	if ((cpu_time - start) >= CPU_RATE_MIN_TIME) {
+		cpu_rate = (cpu_rate * 3 + (steps << CPU_RATE_SHIFT)/(cpu_time - start)) >> 2;
+		if (cpu_rate > CPU_RATE_MAX) {
+			cpu_rate = CPU_RATE_MAX;
+		}
+	}
+}
+
+bool_t emu_init(const volatile u12_t *program, void (*cb)(void))
+{
+	g_program = program;
+	halt_cb = cb;
+
+	job_set_name(&cpu_job, "cpu");
+	job_set_slack(&cpu_job, MS_TO_MCU_TIME(EMU_JOB_SLACK));
+
+	cpu_rate = CPU_RATE_INIT;
+	cpu_halted = 0;
+
+	/* TamaLIB must use an integer time base of at least 32768 Hz,
+	 * so shift the one provided by the MCU until it fits. TamaLIB
+	 * truncates the duration of each instruction to this time base,
+	 * so it must also be fine enough for the highest speed level.
+	 */
+	time_shift = 0;
+	while (((MCU_TIME_FREQ_X1000 << time_shift) < TAMALIB_FREQ * 1000 * TAMALIB_SPEED_MAX) || (MCU_TIME_FREQ_X1000 << time_shift) % 1000) {
+		time_shift++;
+	}
+
+	return tamalib_init((const u12_t *) program, NULL, (MCU_TIME_FREQ_X1000 << time_shift)/1000);
+}
+
+void emu_start(void)
+{
+	job_schedule(&cpu_job, &cpu_job_fn, JOB_ASAP);
+}
+
+void emu_stop(void)
+{
+	job_cancel(&cpu_job);
+}
+
+void emu_set_speed(uint8_t ratio, uint8_t cpu_share)
+{
+	/* The time spent halted is counted at the previous speed */
+	emu_wake();
+
+	speed_ratio = ratio;
+	speed_cpu_share = cpu_share;
+	tamalib_set_speed(ratio);
+}
+
+void emu_set_paused(bool_t paused)
+{
+	emu_wake();
+
+	emulation_paused = paused;
+	tamalib_set_exec_mode(paused ? EXEC_MODE_PAUSE : EXEC_MODE_RUN);
+}
+
+void emu_wake(void)
+{
+	/* Something is about to change the emulated CPU state */
+	if (cpu_halted) {
+		cpu_resume(time_get());
+		job_schedule(&cpu_job, &cpu_job_fn, JOB_ASAP);
+	}
+}
+
+void emu_reset(void)
+{
+	/* A halted CPU would resume from its previous tick counter */
+	emu_wake();
+
+	cpu_reset();
+}
+
+void emu_sync(mcu_time_t time)
+{
+	/* TamaLIB is where the given time is */
+	cpu_running = 1;
+	cpu_time = time;
+	cpu_sync_ref_timestamp();
+	cpu_running = 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _EMU_H_
+#define _EMU_H_
+
+#include <stdint.h>
+
+#include "time.h"
+
+#include "lib/tamalib.h"
+
+#define TAMALIB_FREQ					32768 // Hz
+#define TAMALIB_SPEED_MAX				8 // Highest finite speed level
+
+#define EMU_JOB_PERIOD					10 //ms
+#define EMU_JOB_SLACK					2 //ms, how early the job is allowed to run to share a wakeup
+
+/* E0C6S46 timers that can wake the CPU up from HALT, in TamaLIB ticks */
+#define HALT_OPCODE					0xFF8
+#define PC_MASK						0x1FFF
+#define CLK_TIMER_PERIOD				32768 // 1 Hz interrupt
+#define PROG_TIMER_PERIOD				128 // 256 Hz down-counter
+
+
+/* HAL callbacks handling the time of TamaLIB */
+timestamp_t emu_get_timestamp(void);
+void emu_sleep_until(timestamp_t ts);
+
+/* halt_cb is called each time the ROM halts, waiting for an interrupt */
+bool_t emu_init(const volatile u12_t *program, void (*halt_cb)(void));
+
+void emu_start(void);
+void emu_stop(void);
+
+void emu_set_speed(uint8_t ratio, uint8_t cpu_share);
+void emu_set_paused(bool_t paused);
+
+void emu_wake(void);
+void emu_reset(void);
+void emu_sync(mcu_time_t time);
+
+u32_t emu_get_next_int_tick(state_t *state);
+
+#endif /* _EMU_H_ */
@@ -22,17 +22,49 @@
 
 #include "gfx.h"
 
-#define FRAMEBUFFER_SIZE			((DISPLAY_WIDTH * DISPLAY_HEIGHT) >> 3)
+#define DISPLAY_PAGES				(DISPLAY_HEIGHT >> 3)
+#define FRAMEBUFFER_SIZE			GFX_LAYER_SIZE
 
 #define FONT_WIDTH				5
 #define FONT_HEIGHT				8
 #define FONT_SPACE				0
 #define FONT_ADVANCE				(FONT_WIDTH + FONT_SPACE)
+#define FONT_SIZE_MAX				7
 
-static void (*disp_send_data_cb)(uint8_t *, uint16_t) = NULL;
+static void (*disp_send_window_cb)(uint8_t *, uint8_t, uint8_t, uint8_t) = NULL;
+static uint8_t disp_async = 0;
 
 static uint8_t fb[FRAMEBUFFER_SIZE];
 
+/* Where the drawing functions draw, fb or a layer */
+static uint8_t *canvas = fb;
+
+/* Columns of each page drawn in fb since the last frame, empty if start > end.
+ * Only these are sent, so the content of the display is not kept.
+ */
+static uint8_t dirty_start[DISPLAY_PAGES];
+static uint8_t dirty_end[DISPLAY_PAGES];
+static uint8_t display_synced = 0;
+
+/* Window being sent, copied from fb so that the drawing can go on meanwhile.
+ * A column drawn after its window is copied is sent again with the next frame.
+ */
+static uint8_t win_buf[DISPLAY_WIDTH];
+
+/* Column window of each page in the current frame, empty if start > end */
+static uint8_t win_start[DISPLAY_PAGES];
+static uint8_t win_end[DISPLAY_PAGES];
+static uint8_t win_page = DISPLAY_PAGES;
+
+static uint8_t frame_sending = 0;
+static uint8_t frame_pending = 0;
+
+/* Rows holding lit pixels, as an OR of the columns of each page sent */
+static void (*disp_rows_cb)(uint8_t, uint8_t) = NULL;
+static uint8_t page_bits[DISPLAY_PAGES];
+static uint8_t rows_first = 0, rows_count = DISPLAY_HEIGHT; // Driven by the display
+static uint8_t frame_first, frame_count; // Needed by the frame being sent
+
 /* 5x8 font from https://github.com/pyrohaz/STM32F0-SSD1306 */
 static const uint8_t font_table[][FONT_WIDTH] = {
 	{0x00, 0x00, 0x00, 0x00, 0x00}, // 20
@@ -135,33 +167,165 @@ static const uint8_t font_table[][FONT_WIDTH] = {
 };
 
 
+static void mark_dirty(uint8_t page, uint8_t start, uint8_t end)
+{
+	if (canvas != fb) {
+		/* The layers are sent once copied into fb */
+		return;
+	}
+
+	if (start < dirty_start[page]) {
+		dirty_start[page] = start;
+	}
+
+	if (end > dirty_end[page]) {
+		dirty_end[page] = end;
+	}
+}
+
 void gfx_pixel(uint8_t x, uint8_t y, color_t color)
 {
 	if (x >= DISPLAY_WIDTH || y >= DISPLAY_HEIGHT) {
 		return;
 	}
 
+	mark_dirty(y >> 3, x, x);
+
 	if (color == COLOR_ON_BLACK) {
-		fb[((y >> 3) * DISPLAY_WIDTH) + x] |= 0x1 << (y % 8);
+		canvas[((y >> 3) * DISPLAY_WIDTH) + x] |= 0x1 << (y % 8);
 	} else {
-		fb[((y >> 3) * DISPLAY_WIDTH) + x] &= ~(0x1 << (y % 8));
+		canvas[((y >> 3) * DISPLAY_WIDTH) + x] &= ~(0x1 << (y % 8));
 	}
 }
 
 void gfx_square(uint8_t x, uint8_t y, uint8_t w, uint8_t h, color_t color)
 {
-	uint8_t i, j;
+	uint16_t bottom = y + h;
+	uint8_t page, last, mask;
+	uint8_t *ptr;
+	uint8_t i;
+
+	if (x >= DISPLAY_WIDTH || y >= DISPLAY_HEIGHT || w == 0 || h == 0) {
+		return;
+	}
+
+	if (x + w > DISPLAY_WIDTH) {
+		w = DISPLAY_WIDTH - x;
+	}
+
+	if (bottom > DISPLAY_HEIGHT) {
+		bottom = DISPLAY_HEIGHT;
+	}
+
+	/* Only the first and last pages are partially covered */
+	last = (bottom - 1) >> 3;
+
+	for (page = y >> 3; page <= last; page++) {
+		mask = 0xFF;
+
+		if (page == (y >> 3)) {
+			mask &= 0xFF << (y & 0x7);
+		}
+
+		if (page == last) {
+			mask &= 0xFF >> (7 - ((bottom - 1) & 0x7));
+		}
+
+		ptr = &canvas[page * DISPLAY_WIDTH + x];
+		mark_dirty(page, x, x + w - 1);
+
+		if (color == COLOR_ON_BLACK) {
+			for (i = 0; i < w; i++) {
+				ptr[i] |= mask;
+			}
+		} else {
+			for (i = 0; i < w; i++) {
+				ptr[i] &= ~mask;
+			}
+		}
+	}
+}
+
+/* Turns on the pixels set in bits (up to 56, LSB at the top) in w adjacent
+ * columns starting at x, writing whole framebuffer bytes
+ */
+void gfx_column(uint8_t x, uint8_t y, uint64_t bits, uint8_t w)
+{
+	uint8_t page = y >> 3;
+	uint8_t *ptr;
+	uint8_t i;
+
+	if (x + w > DISPLAY_WIDTH) {
+		w = (x < DISPLAY_WIDTH) ? DISPLAY_WIDTH - x : 0;
+	}
+
+	if (w == 0) {
+		return;
+	}
+
+	bits <<= (y & 0x7);
+
+	for (; bits != 0 && page < DISPLAY_PAGES; page++, bits >>= 8) {
+		if (bits & 0xFF) {
+			ptr = &canvas[page * DISPLAY_WIDTH + x];
+			mark_dirty(page, x, x + w - 1);
+
+			for (i = 0; i < w; i++) {
+				ptr[i] |= (uint8_t) bits;
+			}
+		}
+	}
+}
+
+/* ORs a w x h sprite in page layout (see gfx.h) at x/y, shifting its pages
+ * across two framebuffer pages when y is not page-aligned
+ */
+void gfx_blit(const uint8_t *sprite, uint8_t x, uint8_t y, uint8_t w, uint8_t h)
+{
+	uint8_t page = y >> 3;
+	uint8_t shift = y & 0x7;
+	uint8_t pages = (h + 7) >> 3;
+	uint8_t src_w = w;
+	uint8_t *ptr;
+	uint8_t i, p;
+
+	if (x + w > DISPLAY_WIDTH) {
+		w = (x < DISPLAY_WIDTH) ? DISPLAY_WIDTH - x : 0;
+	}
+
+	if (w == 0) {
+		return;
+	}
+
+	for (p = 0; p < pages && page < DISPLAY_PAGES; p++, page++, sprite += src_w) {
+		ptr = &canvas[page * DISPLAY_WIDTH + x];
+		mark_dirty(page, x, x + w - 1);
+
+		if (shift && page + 1 < DISPLAY_PAGES) {
+			mark_dirty(page + 1, x, x + w - 1);
+		}
 
-	for (j = 0; j < h; j++) {
 		for (i = 0; i < w; i++) {
-			gfx_pixel(x + i, y + j, color);
+			ptr[i] |= sprite[i] << shift;
+		}
+
+		if (shift && page + 1 < DISPLAY_PAGES) {
+			ptr += DISPLAY_WIDTH;
+
+			for (i = 0; i < w; i++) {
+				ptr[i] |= sprite[i] >> (8 - shift);
+			}
 		}
 	}
 }
 
 uint8_t gfx_char(unsigned char c, uint8_t x, uint8_t y, uint8_t size, color_t color, background_t bg)
 {
-	uint8_t i, j;
+	const uint8_t *glyph;
+	uint64_t box, bits;
+	uint8_t page, shift, mask, byte;
+	uint8_t *ptr;
+	uint8_t i, j, k, col;
 
 	if (c < 0x20 || c > 0x7F) {
 		return 0;
@@ -169,18 +333,51 @@ uint8_t gfx_char(unsigned char c, uint8_t x, uint8_t y, uint8_t size, color_t co
 
 	size++;
 
-	for (j = 0; j < (FONT_HEIGHT * size); j++) {
-		for (i = 0; i < (FONT_WIDTH * size); i++) {
-			if (font_table[c - 0x20][i/size] & (0x1 << j/size)) {
-				gfx_pixel(x + i, y + j, color);
-			} else if (bg == BACKGROUND_ON) {
-				gfx_pixel(x + i, y + j, !color);
+	/* A scaled glyph column must fit in 64 bits once shifted */
+	if (size > FONT_SIZE_MAX) {
+		size = FONT_SIZE_MAX;
+	}
+
+	glyph = font_table[c - 0x20];
+	page = y >> 3;
+	shift = y & 0x7;
+
+	/* Pixels of the glyph box that are written, the background ones included if needed */
+	box = (bg == BACKGROUND_ON) ? (((1ULL << (FONT_HEIGHT * size)) - 1) << shift) : 0;
+
+	for (i = 0; i < FONT_ADVANCE; i++) {
+		bits = 0;
+
+		if (i < FONT_WIDTH) {
+			for (j = 0; j < FONT_HEIGHT; j++) {
+				if (glyph[i] & (0x1 << j)) {
+					bits |= ((1ULL << size) - 1) << (j * size);
+				}
 			}
+
+			bits <<= shift;
+		}
+
+		if (bg == BACKGROUND_OFF) {
+			box = bits;
 		}
 
-		if (bg == BACKGROUND_ON) {
-			for (; i < (FONT_ADVANCE * size); i++) {
-				gfx_pixel(x + i, y + j, !color);
+		/* Each column of the glyph is written size times, a whole byte per page */
+		for (k = 0; k < size; k++) {
+			col = x + i * size + k;
+
+			if (col >= DISPLAY_WIDTH) {
+				continue;
+			}
+
+			ptr = &canvas[page * DISPLAY_WIDTH + col];
+
+			for (j = page; j < DISPLAY_PAGES && (box >> ((j - page) * 8)) != 0; j++, ptr += DISPLAY_WIDTH) {
+				mask = box >> ((j - page) * 8);
+				byte = bits >> ((j - page) * 8);
+				mark_dirty(j, col, col);
+
+				*ptr = (*ptr & ~mask) | ((color == COLOR_ON_BLACK) ? byte : (mask & ~byte));
 			}
 		}
 	}
@@ -200,17 +397,209 @@ uint8_t gfx_string(char *str, uint8_t x, uint8_t y, uint8_t size, color_t color,
 
 void gfx_clear(void)
 {
-	memset(fb, 0, FRAMEBUFFER_SIZE);
+	uint8_t page, start, end;
+	uint8_t *ptr;
+
+	if (canvas == fb) {
+		/* Only the lit columns change */
+		for (page = 0; page < DISPLAY_PAGES; page++) {
+			ptr = &fb[page * DISPLAY_WIDTH];
+
+			for (start = 0; start < DISPLAY_WIDTH && ptr[start] == 0; start++);
+
+			if (start < DISPLAY_WIDTH) {
+				for (end = DISPLAY_WIDTH - 1; ptr[end] == 0; end--);
+				mark_dirty(page, start, end);
+			}
+		}
+	}
+
+	memset(canvas, 0, FRAMEBUFFER_SIZE);
 }
 
-void gfx_register_display(void (*cb)(uint8_t *, uint16_t))
+void gfx_set_layer(uint8_t *layer)
 {
-	disp_send_data_cb = cb;
+	canvas = (layer != NULL) ? layer : fb;
+}
+
+void gfx_copy_layer(const uint8_t *layer)
+{
+	uint8_t page, start, end;
+	const uint8_t *src;
+	uint8_t *ptr;
+
+	if (canvas == fb) {
+		/* Only the columns that differ change */
+		for (page = 0; page < DISPLAY_PAGES; page++) {
+			ptr = &fb[page * DISPLAY_WIDTH];
+			src = &layer[page * DISPLAY_WIDTH];
+
+			for (start = 0; start < DISPLAY_WIDTH && ptr[start] == src[start]; start++);
+
+			if (start < DISPLAY_WIDTH) {
+				for (end = DISPLAY_WIDTH - 1; ptr[end] == src[end]; end--);
+				mark_dirty(page, start, end);
+			}
+		}
+	}
+
+	memcpy(canvas, layer, FRAMEBUFFER_SIZE);
+}
+
+void gfx_register_display(void (*cb)(uint8_t *, uint8_t, uint8_t, uint8_t), uint8_t async)
+{
+	disp_send_window_cb = cb;
+	disp_async = async;
+	display_synced = 0;
+}
+
+void gfx_register_rows(void (*cb)(uint8_t, uint8_t))
+{
+	disp_rows_cb = cb;
+	rows_first = 0;
+	rows_count = DISPLAY_HEIGHT;
+
+	/* page_bits is only kept up to date from there */
+	display_synced = 0;
+}
+
+static void set_rows(uint8_t first, uint8_t count)
+{
+	if (first != rows_first || count != rows_count) {
+		rows_first = first;
+		rows_count = count;
+		disp_rows_cb(first, count);
+	}
+}
+
+static void update_frame_rows(void)
+{
+	uint8_t page, bits, first = DISPLAY_HEIGHT, last = 0;
+	uint8_t *ptr;
+	uint8_t i;
+
+	for (page = 0; page < DISPLAY_PAGES; page++) {
+		if (win_start[page] <= win_end[page]) {
+			/* Changed page */
+			ptr = &fb[page * DISPLAY_WIDTH];
+
+			for (bits = 0, i = 0; i < DISPLAY_WIDTH; i++) {
+				bits |= ptr[i];
+			}
+
+			page_bits[page] = bits;
+		}
+
+		bits = page_bits[page];
+
+		if (bits != 0) {
+			if (first == DISPLAY_HEIGHT) {
+				first = (page << 3) + __builtin_ctz(bits);
+			}
+
+			last = (page << 3) + 31 - __builtin_clz(bits);
+		}
+	}
+
+	frame_first = (first < DISPLAY_HEIGHT) ? first : 0;
+	frame_count = (first < DISPLAY_HEIGHT) ? last - first + 1 : 0;
+}
+
+static void send_next_window(void)
+{
+	uint8_t page;
+
+	while (win_page < DISPLAY_PAGES) {
+		page = win_page++;
+
+		if (win_start[page] > win_end[page]) {
+			/* Unchanged page */
+			continue;
+		}
+
+		memcpy(win_buf, &fb[page * DISPLAY_WIDTH + win_start[page]], win_end[page] - win_start[page] + 1);
+		disp_send_window_cb(win_buf, page, win_start[page], win_end[page]);
+
+		if (disp_async) {
+			/* The rest follows gfx_display_done() */
+			frame_sending = 1;
+			return;
+		}
+	}
+
+	frame_sending = 0;
+
+	if (disp_rows_cb != NULL) {
+		/* The rows that are now empty can be released */
+		set_rows(frame_first, frame_count);
+	}
+
+	if (frame_pending) {
+		/* The framebuffer changed while the previous frame was being sent */
+		frame_pending = 0;
+		gfx_print_screen();
+	}
 }
 
 void gfx_print_screen(void)
 {
-	if (disp_send_data_cb != NULL) {
-		disp_send_data_cb(fb, FRAMEBUFFER_SIZE);
+	uint8_t page, start, end;
+
+	if (disp_send_window_cb == NULL) {
+		return;
+	}
+
+	if (frame_sending) {
+		/* The windows cannot change until the current frame is sent */
+		frame_pending = 1;
+		return;
+	}
+
+	/* Each page is sent as a single window covering the columns drawn */
+	for (page = 0; page < DISPLAY_PAGES; page++) {
+		if (display_synced) {
+			start = dirty_start[page];
+			end = dirty_end[page];
+		} else {
+			/* The content of the display is unknown */
+			start = 0;
+			end = DISPLAY_WIDTH - 1;
+		}
+
+		win_start[page] = start;
+		win_end[page] = end;
+
+		dirty_start[page] = DISPLAY_WIDTH;
+		dirty_end[page] = 0;
+	}
+
+	display_synced = 1;
+
+	if (disp_rows_cb != NULL) {
+		/* The rows of both frames are driven while the new one is being sent */
+		update_frame_rows();
+
+		if (rows_count == 0) {
+			set_rows(frame_first, frame_count);
+		} else if (frame_count > 0) {
+			start = (frame_first < rows_first) ? frame_first : rows_first;
+			end = (frame_first + frame_count > rows_first + rows_count) ? frame_first + frame_count : rows_first + rows_count;
+			set_rows(start, end - start);
+		}
+	}
+
+	win_page = 0;
+	send_next_window();
+}
+
+void gfx_display_done(void)
+{
+	if (frame_sending) {
+		send_next_window();
 	}
 }
+
+uint8_t gfx_is_sending(void)
+{
+	return frame_sending;
+}
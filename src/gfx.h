@@ -25,6 +25,8 @@
 #define DISPLAY_WIDTH				128
 #define DISPLAY_HEIGHT				64
 
+#define GFX_LAYER_SIZE				(DISPLAY_WIDTH * (DISPLAY_HEIGHT >> 3))
+
 typedef enum {
 	COLOR_OFF_WHITE = 0,
 	COLOR_ON_BLACK = 1,
@@ -35,15 +37,50 @@ typedef enum {
 	BACKGROUND_ON = 1,
 } background_t;
 
+/* Sprites are stored in the page layout of the display: for each page of 8 rows,
+ * one byte per column with the LSB at the top. The SPRITE_* macros pack, at compile
+ * time, 8 rows of a sprite of width w written as binary literals (MSB on the left).
+ */
+#define SPRITE_BIT(w, c, n, r)				((((r) >> ((w) - 1 - (c))) & 0x1) << (n))
+#define SPRITE_COL(w, c, r0, r1, r2, r3, r4, r5, r6, r7)	\
+	(SPRITE_BIT(w, c, 0, r0) | SPRITE_BIT(w, c, 1, r1) | SPRITE_BIT(w, c, 2, r2) | SPRITE_BIT(w, c, 3, r3) | \
+	SPRITE_BIT(w, c, 4, r4) | SPRITE_BIT(w, c, 5, r5) | SPRITE_BIT(w, c, 6, r6) | SPRITE_BIT(w, c, 7, r7))
+#define SPRITE_COL2(w, c, ...)				SPRITE_COL(w, c, __VA_ARGS__), SPRITE_COL(w, (c) + 1, __VA_ARGS__)
+#define SPRITE_COL4(w, c, ...)				SPRITE_COL2(w, c, __VA_ARGS__), SPRITE_COL2(w, (c) + 2, __VA_ARGS__)
+#define SPRITE_PAGE4(...)				SPRITE_COL4(4, 0, __VA_ARGS__)
+#define SPRITE_PAGE6(...)				SPRITE_COL4(6, 0, __VA_ARGS__), SPRITE_COL2(6, 4, __VA_ARGS__)
+#define SPRITE_PAGE8(...)				SPRITE_COL4(8, 0, __VA_ARGS__), SPRITE_COL4(8, 4, __VA_ARGS__)
+#define SPRITE_PAGE12(...)				SPRITE_COL4(12, 0, __VA_ARGS__), SPRITE_COL4(12, 4, __VA_ARGS__), SPRITE_COL4(12, 8, __VA_ARGS__)
+
 
 void gfx_pixel(uint8_t x, uint8_t y, color_t color);
 void gfx_square(uint8_t x, uint8_t y, uint8_t w, uint8_t h, color_t color);
+void gfx_column(uint8_t x, uint8_t y, uint64_t bits, uint8_t w);
+void gfx_blit(const uint8_t *sprite, uint8_t x, uint8_t y, uint8_t w, uint8_t h);
 uint8_t gfx_char(unsigned char c, uint8_t x, uint8_t y, uint8_t size, color_t color, background_t bg);
 uint8_t gfx_string(char *str, uint8_t x, uint8_t y, uint8_t size, color_t color, background_t bg);
 void gfx_clear(void);
 
-void gfx_register_display(void (*cb)(uint8_t *, uint16_t));
+/* A layer is a buffer of GFX_LAYER_SIZE bytes in the framebuffer layout. Once
+ * set, the drawing functions draw into it instead of the framebuffer (NULL).
+ * Copying it into the framebuffer lets the layers above it be drawn on top
+ * without drawing it again.
+ */
+void gfx_set_layer(uint8_t *layer);
+void gfx_copy_layer(const uint8_t *layer);
+
+/* An async display returns before the window is sent, and gfx_display_done()
+ * must then be called once it has been (not from IRQ context)
+ */
+void gfx_register_display(void (*cb)(uint8_t *, uint8_t, uint8_t, uint8_t), uint8_t async);
+
+/* The callback is given the span of the rows holding lit pixels (count being 0
+ * if there is none), the rows of both frames being kept while one is sent
+ */
+void gfx_register_rows(void (*cb)(uint8_t first, uint8_t count));
 
 void gfx_print_screen(void);
+void gfx_display_done(void);
+uint8_t gfx_is_sending(void);
 
 #endif /* _GFX_H_ */
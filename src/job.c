@@ -23,28 +23,133 @@
 #include "system.h"
 #include "job.h"
 
-static job_t *jobs = NULL;
+/* The queue is a binary min-heap ordered by time, then by scheduling
+ * order so that the jobs due at the same time run first come first
+ * served. Each job keeps track of its own position so that it can be
+ * moved or removed in O(log n).
+ * A job with some slack can run anywhere in [time - slack, time], so the
+ * CPU only wakes up for the earliest time and then runs every job whose
+ * window is already open.
+ */
+static job_t *jobs[JOB_QUEUE_SIZE];
+static uint8_t jobs_num = 0;
+static uint32_t jobs_seq = 0;
 
+#ifdef JOB_STATS
+/* All the named jobs, in naming order */
+static job_t *stats_jobs = NULL;
+static job_t **stats_jobs_tail = &stats_jobs;
 
-void job_schedule(job_t *job, void (*cb)(job_t *), mcu_time_t time)
+static job_sleep_stats_t sleep_stats = {0};
+#endif
+
+
+static uint8_t is_before(job_t *a, job_t *b)
+{
+	if (a->time == b->time) {
+		/* Same order as the scheduling one, like the sorted list did */
+		return ((int32_t) (a->seq - b->seq) < 0);
+	}
+
+	if (a->time == JOB_ASAP) {
+		return 1;
+	}
+
+	if (b->time == JOB_ASAP) {
+		return 0;
+	}
+
+	return ((int32_t) (a->time - b->time) < 0);
+}
+
+static void heap_set(uint32_t i, job_t *job)
+{
+	jobs[i] = job;
+	job->queued = i + 1;
+}
+
+static void heap_sift_up(uint32_t i)
 {
-	job_t **j = &jobs;
+	job_t *job = jobs[i];
+	uint32_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) >> 1;
+
+		if (!is_before(job, jobs[parent])) {
+			break;
+		}
+
+		heap_set(i, jobs[parent]);
+		i = parent;
+	}
+
+	heap_set(i, job);
+}
 
+static void heap_sift_down(uint32_t i)
+{
+	job_t *job = jobs[i];
+	uint32_t child;
+
+	while ((child = (i << 1) + 1) < jobs_num) {
+		if (child + 1 < jobs_num && is_before(jobs[child + 1], jobs[child])) {
+			child++;
+		}
+
+		if (!is_before(jobs[child], job)) {
+			break;
+		}
+
+		heap_set(i, jobs[child]);
+		i = child;
+	}
+
+	heap_set(i, job);
+}
+
+static void heap_remove(job_t *job)
+{
+	uint32_t i = job->queued - 1;
+	job_t *last;
+
+	job->queued = 0;
+	jobs_num--;
+
+	if (i == jobs_num) {
+		/* The job was the last one, nothing to reorder */
+		return;
+	}
+
+	/* Move the last job in the hole and restore the heap property */
+	last = jobs[jobs_num];
+	heap_set(i, last);
+	heap_sift_up(i);
+	heap_sift_down(last->queued - 1);
+}
+
+void job_schedule(job_t *job, void (*cb)(job_t *), mcu_time_t time)
+{
 	/* Disable IRQs handling */
 	system_disable_irq();
 
-	/* Remove the job if it is already in the queue */
-	job_cancel(job);
-
 	job->cb = cb;
 	job->time = time;
+	job->seq = jobs_seq++;
 
-	while (*j != NULL && (int32_t) (time - (*j)->time) >= 0) {
-		j = &((*j)->next);
-	}
+	if (job->queued) {
+		/* The job is already in the queue, just move it */
+		heap_sift_up(job->queued - 1);
+		heap_sift_down(job->queued - 1);
+	} else {
+		if (jobs_num >= JOB_QUEUE_SIZE) {
+			system_fatal_error();
+		}
 
-	job->next = *j;
-	*j = job;
+		heap_set(jobs_num, job);
+		jobs_num++;
+		heap_sift_up(jobs_num - 1);
+	}
 
 	/* Enable IRQs handling */
 	system_enable_irq();
@@ -52,52 +157,134 @@ void job_schedule(job_t *job, void (*cb)(job_t *), mcu_time_t time)
 
 void job_cancel(job_t *job)
 {
-	job_t **j = &jobs;
-
 	/* Disable IRQs handling */
 	system_disable_irq();
 
-	while (*j != NULL) {
-		if (*j == job) {
-			*j = job->next;
-			break;
-		}
-
-		j = &((*j)->next);
+	if (job->queued) {
+		heap_remove(job);
 	}
 
 	/* Enable IRQs handling */
 	system_enable_irq();
 }
 
+void job_schedule_next(job_t *job, mcu_time_t period)
+{
+	mcu_time_t now = time_get();
+	mcu_time_t time = job->time + period;
+
+	/* The period is counted from the scheduled time rather than from now, so that
+	 * running a job early within its slack does not make it run more often.
+	 * Start over from now if it is too late for that.
+	 */
+	if (job->time == JOB_ASAP || (int32_t) (time - now) < 0) {
+		time = now + period;
+	}
+
+	job_schedule(job, job->cb, time);
+}
+
+void job_set_slack(job_t *job, mcu_time_t slack)
+{
+	job->slack = slack;
+}
+
 job_t * job_get_next(void)
 {
-	return jobs;
+	return (jobs_num > 0) ? jobs[0] : NULL;
+}
+
+#ifdef JOB_STATS
+void job_set_name(job_t *job, const char *name)
+{
+	if (job->name == NULL) {
+		/* First time this job is named, keep track of it */
+		job->stats_next = NULL;
+		*stats_jobs_tail = job;
+		stats_jobs_tail = &(job->stats_next);
+	}
+
+	job->name = name;
+}
+
+job_t * job_stats_get_next(job_t *job)
+{
+	return (job == NULL) ? stats_jobs : job->stats_next;
 }
 
+const job_sleep_stats_t * job_stats_get_sleep(void)
+{
+	return &sleep_stats;
+}
+
+void job_stats_reset(void)
+{
+	job_t *j;
+	uint8_t i;
+
+	for (j = stats_jobs; j != NULL; j = j->stats_next) {
+		j->stats.runs = 0;
+		j->stats.late_total = 0;
+		j->stats.late_max = 0;
+		j->stats.run_total = 0;
+		j->stats.run_max = 0;
+	}
+
+	sleep_stats.wakeups = 0;
+	for (i = 0; i < STATE_NUM; i++) {
+		sleep_stats.residency[i] = 0;
+	}
+	sleep_stats.since = time_get();
+}
+
+static void stats_update(job_t *job, mcu_time_t late, mcu_time_t run)
+{
+	job->stats.runs++;
+
+	job->stats.late_total += late;
+	if (late > job->stats.late_max) {
+		job->stats.late_max = late;
+	}
+
+	job->stats.run_total += run;
+	if (run > job->stats.run_max) {
+		job->stats.run_max = run;
+	}
+}
+#endif
+
 void job_mainloop(void)
 {
 	job_t *j = NULL;
 	exec_state_t state;
+	mcu_time_t now;
+#ifdef JOB_STATS
+	mcu_time_t start, late;
+#endif
 
 	while (1) {
+		now = time_get();
+
 		/* Disable IRQs handling */
 		system_disable_irq();
 
-		if (jobs != NULL) {
-			if (jobs->time == JOB_ASAP) {
+		if (jobs_num > 0) {
+			if (jobs[0]->time == JOB_ASAP || (int32_t) (now - (jobs[0]->time - jobs[0]->slack)) >= 0) {
+				/* The job is allowed to run now, since the CPU is awake anyway.
+				 * This is how jobs with overlapping windows end up sharing a single wakeup.
+				 */
 				state = STATE_RUN;
 			} else {
-				state = time_configure_wakeup(jobs->time);
+				state = time_configure_wakeup(jobs[0]->time);
 			}
 		} else {
 			state = system_get_max_state();
 		}
 
 		if (state == STATE_RUN) {
-			if (jobs != NULL) {
-				j = jobs;
-				jobs = j->next;
+			if (jobs_num > 0) {
+				j = jobs[0];
+				heap_remove(j);
 			}
 		} else {
 			system_enter_state(state);
@@ -106,9 +293,29 @@ void job_mainloop(void)
 		/* Enable IRQs handling */
 		system_enable_irq();
 
+#ifdef JOB_STATS
+		if (state != STATE_RUN) {
+			sleep_stats.wakeups++;
+			sleep_stats.residency[state] += time_get() - now;
+		}
+#endif
+
 		if (j != NULL) {
-			time_wait_until(j->time);
+			if (j->time != JOB_ASAP) {
+				time_wait_until(j->time - j->slack);
+			}
+
+#ifdef JOB_STATS
+			/* The callback might reschedule the job, so get the lateness first */
+			start = time_get();
+			late = (j->time != JOB_ASAP && (int32_t) (start - j->time) > 0) ? start - j->time : 0;
+
+			j->cb(j);
+
+			stats_update(j, late, time_get() - start);
+#else
 			j->cb(j);
+#endif
 			j = NULL;
 		}
 	}
@@ -20,22 +20,71 @@
 #ifndef _JOB_H_
 #define _JOB_H_
 
+#include <stdint.h>
+
 #include "time.h"
+#include "system.h"
+
+/* Define this to enable the per-job lateness and runtime accounting */
+//#define JOB_STATS
 
 #define JOB_ASAP				0
 
+/* Maximum number of jobs that can be queued at the same time. A job is
+ * queued at most once, so this only has to cover every job_t of the
+ * firmware: at most 25, on the STM32L0 board with PROFILER defined (9 in
+ * main.c plus the profiler one, 2 for each of the 5 inputs, and one each
+ * for the emulation, the display power-up, the LED, the battery and the
+ * storage), 24 on the STM32F0 board which has no battery job.
+ */
+#define JOB_QUEUE_SIZE				32
+
+typedef struct {
+	uint32_t runs;
+	mcu_time_t late_total;
+	mcu_time_t late_max;
+	mcu_time_t run_total;
+	mcu_time_t run_max;
+} job_stats_t;
+
+typedef struct {
+	uint32_t wakeups;
+	mcu_time_t residency[STATE_NUM]; // Time spent in each low-power state
+	mcu_time_t since;
+} job_sleep_stats_t;
+
 typedef struct job {
 	mcu_time_t time;
+	mcu_time_t slack; // The job can run up to slack ticks before time
 	void (*cb)(struct job *);
-	struct job *next;
+	uint32_t seq; // Scheduling order, to run the jobs due at the same time first come first served
+	uint8_t queued; // 0: not queued, n: queued at index n - 1
+#ifdef JOB_STATS
+	const char *name;
+	job_stats_t stats;
+	struct job *stats_next;
+#endif
 } job_t;
 
 
 void job_schedule(job_t *job, void (*cb)(job_t *), mcu_time_t time);
 void job_cancel(job_t *job);
+void job_schedule_next(job_t *job, mcu_time_t period);
+
+void job_set_slack(job_t *job, mcu_time_t slack);
 
 job_t * job_get_next(void);
 
+#ifdef JOB_STATS
+void job_set_name(job_t *job, const char *name);
+
+job_t * job_stats_get_next(job_t *job);
+const job_sleep_stats_t * job_stats_get_sleep(void);
+void job_stats_reset(void);
+#else
+#define job_set_name(job, name)
+#endif
+
 void job_mainloop(void);
 
 #endif /* _JOB_H_ */
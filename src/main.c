@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include <stdint.h>
+#include <string.h>
 
 #include "gfx.h"
 #include "menu.h"
@@ -34,7 +35,11 @@
 #include "fs_ll.h"
 #include "rom.h"
 #include "config.h"
+#include "stats.h"
+#include "prof.h"
 #include "board.h"
+#include "spi.h"
+#include "emu.h"
 #if defined(BOARD_HAS_SSD1306)
 #include "ssd1306.h"
 #elif defined(BOARD_HAS_UC1701X)
@@ -45,6 +50,9 @@
 
 #define FIRMWARE_VERSION				"v0.1"
 
+/* Define this to only drive the rows of the SSD1306 holding lit pixels */
+//#define SCREEN_CROP_ROWS
+
 #define PIXEL_SIZE					3
 #define ICON_SIZE					8
 #define ICON_STRIDE_X					24
@@ -54,6 +62,17 @@
 #define LCD_OFFET_X					16
 #define LCD_OFFET_Y					8
 
+/* Each bit of a nibble of an emulated LCD column scaled to PIXEL_SIZE bits */
+#define SCALE_BIT(n, b)					((((n) >> (b)) & 0x1) ? (((1UL << PIXEL_SIZE) - 1) << ((b) * PIXEL_SIZE)) : 0)
+#define SCALE_NIBBLE(n)					(SCALE_BIT(n, 0) | SCALE_BIT(n, 1) | SCALE_BIT(n, 2) | SCALE_BIT(n, 3))
+
+/* Define this (through the board FWCFG) to draw the dot matrix pixel by pixel
+ * below this number of lit pixels per non-empty column, and by columns above.
+ * It depends on the MCU, and is only set where it has been measured with
+ * render_bench, the other boards always drawing by columns.
+ */
+//#define LCD_COLUMN_MIN_DOTS				5
+
 #define PAUSED_X					34
 #define PAUSED_Y					24
 #define PAUSED_STR					"Paused"
@@ -70,23 +89,70 @@
 #define AUTOSAVING_Y					24
 #define AUTOSAVING_STR					"Autosaving"
 
+#define CATCHUP_X					9
+#define CATCHUP_Y					16
+#define CATCHUP_STR					"Catching up"
+#define CATCHUP_BAR_X					14
+#define CATCHUP_BAR_Y					40
+#define CATCHUP_BAR_W					100
+#define CATCHUP_BAR_H					8
+
 #define BATTERY_ON_X					114
 #define BATTERY_ON_Y					21
 #define BATTERY_OFF_X					58
 #define BATTERY_OFF_Y					21
 #define BATTERY_W					12
-#define BATTERY_THICKNESS				2
-#define BATTERY_LVL_THICKNESS				2
-
-#define FRAMERATE 					30
+#define BATTERY_H					22
+#define BATTERY_LVL_X					3
+#define BATTERY_LVL_Y					17
+#define BATTERY_LVL_W					6
+#define BATTERY_LVL_H					2
+#define BATTERY_LVL_STRIDE				3
+#define BATTERY_BOLT_X					4
+#define BATTERY_BOLT_Y					-7
+#define BATTERY_BOLT_W					4
+#define BATTERY_BOLT_H					6
+
+#define CONTRAST_DIM					0x10
+#define CONTRAST_STEP					0x10
+
+#define FRAMERATE 					30 // Max
+#define OVERLAY_REFRESH_PERIOD				1000 //ms, min refresh while the LCD is idle
 
-#define TAMALIB_FREQ					32768 // Hz
-
-#define MAIN_JOB_PERIOD					10 //ms
 #define BATTERY_JOB_PERIOD				60000 //ms
 #define BACKLIGHT_OFF_PERIOD				5000 //ms
+#define CONTRAST_STEP_PERIOD				100 //ms, SSD1306 boards dim the screen instead
 #define AUTOSAVE_PERIOD					3600000 //ms
 #define AUTOOFF_PERIOD					30000 //ms
+#define SUSPEND_JOB_PERIOD				86400000 //ms, must be shorter than the MCU time wrap period
+#define IDLE_SUSPEND_PERIOD				300000 //ms, without any input at x1
+#define CATCHUP_SLICE					20 //ms
+#define CATCHUP_RENDER_PERIOD				500 //ms
+
+/* How early the jobs are allowed to run to share a wakeup with another one */
+#define RENDER_JOB_SLACK				10 //ms
+#define BATTERY_JOB_SLACK				1000 //ms
+#define BACKLIGHT_OFF_SLACK				100 //ms
+#define AUTOSAVE_SLACK					60000 //ms
+#define AUTOOFF_SLACK					1000 //ms
+#define SUSPEND_JOB_SLACK				3600000 //ms
+#define IDLE_SUSPEND_SLACK				10000 //ms
+
+#define FLAG_I						0x8 // Cleared while an interrupt is handled
+
+#define SPEED_LEVEL_NUM					(sizeof(speed_levels)/sizeof(speed_levels[0]))
+#define SPEED_LEVEL_MAX					(SPEED_LEVEL_NUM - 1)
+
+/* Index of the speed level used at boot (the headless benchmark runs at max speed) */
+#ifndef SPEED_LEVEL_INIT
+#define SPEED_LEVEL_INIT				0
+#endif
+
+/* The catch-up is emulated by chunks small enough for the wrapping tick counter */
+#define CATCHUP_CHUNK					(1UL << 30) // ticks
+#define CATCHUP_BATCH					1024 // steps
+
+#define SUSPEND_MAGIC					0x53555350 // "SUSP"
 
 #define BATTERY_MIN					3500 // mV
 #define BATTERY_MAX					4200 // mV
@@ -95,33 +161,119 @@
 
 #define AUTOSAVE_SLOT					0
 
+#define STATS_MENU_SIZE					24 // Including the extra items
+#define STATS_NAME_WIDTH				7 // Including the separator
+
+typedef struct {
+	uint32_t magic;
+	uint64_t elapsed; // mcu_time_t ticks
+} suspend_t;
+
+typedef struct {
+	uint8_t ratio; // TamaLIB speed, 0 means max
+	uint8_t frame_skip; // Frames skipped after each rendered one
+	uint8_t cpu_share; // % of each EMU_JOB_PERIOD the cpu job is allowed to use
+	char *name;
+} speed_level_t;
+
+typedef enum {
+	STATS_MODE_LATE_MAX = 0,
+	STATS_MODE_RUN_MAX,
+	STATS_MODE_RUNS,
+	STATS_MODE_NUM,
+} stats_mode_t;
+
 static volatile u12_t *g_program = (volatile u12_t *) (STORAGE_BASE_ADDRESS + (STORAGE_ROM_OFFSET << 2));
 
-static bool_t matrix_buffer[LCD_HEIGHT][LCD_WIDTH] = {{0}};
+static uint32_t matrix_buffer[LCD_HEIGHT] = {0}; // One bit per pixel, LCD_WIDTH being 32
+
+static const uint32_t scale_lut[16] = {
+	SCALE_NIBBLE(0), SCALE_NIBBLE(1), SCALE_NIBBLE(2), SCALE_NIBBLE(3),
+	SCALE_NIBBLE(4), SCALE_NIBBLE(5), SCALE_NIBBLE(6), SCALE_NIBBLE(7),
+	SCALE_NIBBLE(8), SCALE_NIBBLE(9), SCALE_NIBBLE(10), SCALE_NIBBLE(11),
+	SCALE_NIBBLE(12), SCALE_NIBBLE(13), SCALE_NIBBLE(14), SCALE_NIBBLE(15),
+};
+#ifdef LCD_COLUMN_MIN_DOTS
+/* Bits set in a nibble, Cortex-M0 having no popcount instruction */
+static const uint8_t nibble_dots[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+#endif
 static bool_t icon_buffer[ICON_NUM] = {0};
 
-static uint16_t time_shift = 0;
+/* Copy of the LCD taken at the last frame boundary, which is what gets rendered */
+static uint32_t frame_matrix[LCD_HEIGHT] = {0};
+static bool_t frame_icons[ICON_NUM] = {0};
+static bool_t lcd_changed = 0;
+
+/* Time spent powered off, kept across the reset performed at power on */
+static volatile __attribute__((used, section(".bss_noinit"))) suspend_t suspend_info;
+static bool_t suspended = 0;
+static mcu_time_t suspend_time;
 
-static bool_t tamalib_is_late = 0;
+/* Emulation stopped at x1 after a long time without input, caught up on the next one */
+static bool_t idle_suspend_enabled = 1;
+static bool_t idle_suspended = 0;
 
-static job_t cpu_job;
+static uint64_t catchup_remaining = 0; // TamaLIB ticks left to emulate headless
+static uint64_t catchup_total;
+static mcu_time_t catchup_time;
+
+static job_t catchup_job;
 static job_t render_job;
 static job_t battery_job;
 static job_t backlight_job;
 static job_t autosave_job;
 static job_t autooff_job;
+static job_t suspend_job;
+static job_t idle_job;
+static job_t screen_job;
+#ifdef PROFILER
+static job_t prof_job;
+#endif
+
+/* The higher the speed, the less frames are rendered and the more time is left to
+ * the emulation, but the cpu job never takes the whole MCU, so that the inputs and
+ * the rendering are still handled in time
+ */
+static const speed_level_t speed_levels[] = {
+	{1,	0,	100,	" [x1]"},
+	{2,	0,	100,	" [x2]"},
+	{4,	1,	90,	" [x4]"},
+	{8,	2,	85,	" [x8]"},
+	{0,	3,	80,	"[Max]"},
+};
 
-static uint8_t speed_ratio = 1;
+static uint8_t speed_level = SPEED_LEVEL_INIT;
 static bool_t emulation_paused = 0;
 static bool_t usb_enabled = 0;
 static bool_t rom_loaded = 1;
 static bool_t power_off_mode = 0;
 static bool_t is_backlight_on = 0;
+#if defined(BOARD_HAS_SSD1306)
+static uint8_t screen_contrast = SSD1306_CONTRAST_DEFAULT;
+#endif
 static bool_t is_charging = 0;
 static bool_t is_calling = 0;
 static bool_t is_vbus = 0;
 static uint16_t current_battery = BATTERY_MAX;
 
+/* The render job only redraws the screen if something changed since its last frame */
+static bool_t screen_dirty = 1;
+static uint8_t screen_overlay;
+static mcu_time_t render_time = 0;
+
+/* The emulated LCD (or the "No ROM" screen), only drawn again when it changes,
+ * the overlays being drawn on top of a copy of it
+ */
+static uint8_t lcd_layer[GFX_LAYER_SIZE];
+static bool_t lcd_layer_dirty = 1;
+
+#ifdef JOB_STATS
+static stats_mode_t stats_mode = STATS_MODE_LATE_MAX;
+static char stats_names[STATS_MENU_SIZE][STATS_NAME_WIDTH + 1];
+static uint32_t frames_total = 0;
+static uint32_t frames_skipped = 0;
+#endif
+
 /* Default config values */
 static config_t config = {
 	.lcd_inverted = 0,
@@ -133,92 +285,151 @@ static config_t config = {
 	.autosave_enabled = 1,
 };
 
-static const bool_t icons[ICON_NUM][ICON_SIZE][ICON_SIZE] = {
-	{
-		{1, 0, 1, 0, 1, 0, 0, 1},
-		{1, 0, 1, 0, 1, 0, 1, 1},
-		{1, 1, 1, 1, 1, 0, 1, 1},
-		{0, 1, 1, 1, 0, 1, 1, 1},
-		{0, 0, 1, 0, 0, 1, 1, 1},
-		{0, 0, 1, 0, 0, 0, 1, 1},
-		{0, 0, 1, 0, 0, 0, 0, 1},
-		{0, 0, 1, 0, 0, 0, 0, 1},
-	},
-	{
-		{0, 1, 0, 0, 0, 0, 1, 0},
-		{0, 0, 0, 1, 1, 0, 0, 0},
-		{1, 0, 1, 0, 0, 1, 0, 1},
-		{0, 0, 1, 0, 0, 1, 0, 0},
-		{0, 0, 0, 1, 1, 0, 0, 0},
-		{0, 1, 0, 0, 0, 0, 1, 0},
-		{0, 0, 0, 1, 1, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0},
-	},
-	{
-		{1, 1, 1, 0, 0, 1, 1, 1},
-		{1, 0, 1, 0, 1, 1, 1, 1},
-		{1, 1, 1, 0, 1, 1, 1, 1},
-		{0, 0, 0, 1, 1, 1, 1, 0},
-		{0, 0, 1, 1, 1, 0, 0, 0},
-		{0, 0, 1, 1, 0, 0, 0, 0},
-		{1, 1, 0, 0, 0, 0, 0, 0},
-		{1, 1, 0, 0, 0, 0, 0, 0},
-	},
-	{
-		{0, 0, 0, 1, 1, 1, 0, 0},
-		{0, 0, 0, 0, 1, 1, 1, 0},
-		{0, 0, 0, 1, 1, 1, 1, 1},
-		{0, 0, 1, 1, 0, 1, 1, 1},
-		{0, 1, 1, 0, 1, 1, 0, 1},
-		{0, 1, 1, 1, 1, 0, 0, 0},
-		{1, 1, 1, 1, 0, 0, 0, 0},
-		{1, 1, 0, 0, 0, 0, 0, 0},
-	},
-	{
-		{0, 1, 1, 0, 0, 0, 0, 0},
-		{1, 0, 0, 1, 0, 0, 1, 1},
-		{1, 0, 0, 1, 1, 1, 0, 1},
-		{0, 1, 0, 1, 0, 0, 1, 1},
-		{0, 1, 0, 0, 1, 1, 0, 1},
-		{0, 1, 0, 0, 0, 0, 0, 1},
-		{0, 1, 1, 0, 0, 0, 1, 1},
-		{0, 0, 1, 1, 1, 1, 1, 0},
-	},
-	{
-		{0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 1, 1, 1, 1, 1, 1, 0},
-		{1, 0, 0, 0, 0, 0, 0, 1},
-		{1, 0, 1, 0, 1, 0, 1, 1},
-		{1, 0, 1, 0, 1, 0, 1, 1},
-		{1, 0, 0, 1, 0, 0, 0, 1},
-		{0, 1, 0, 0, 1, 0, 1, 0},
-		{0, 0, 1, 1, 1, 1, 0, 0},
-	},
-	{
-		{0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 1, 0},
-		{0, 0, 0, 0, 0, 1, 0, 1},
-		{0, 1, 1, 1, 0, 1, 0, 1},
-		{1, 1, 1, 0, 0, 1, 0, 1},
-		{1, 1, 0, 0, 1, 0, 1, 0},
-		{1, 1, 1, 0, 0, 0, 0, 0},
-		{0, 1, 1, 1, 0, 0, 0, 0},
-	},
-	{
-		{0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 1, 1, 1, 0, 0, 0, 0},
-		{1, 0, 0, 0, 1, 0, 0, 0},
-		{1, 1, 0, 1, 1, 1, 1, 0},
-		{1, 0, 1, 0, 0, 1, 0, 1},
-		{0, 1, 1, 1, 1, 0, 1, 1},
-		{0, 0, 0, 1, 0, 0, 0, 1},
-		{0, 0, 0, 0, 1, 1, 1, 0},
-	},
+/* Page-format sprites, packed at compile time from their rows of pixels */
+static const uint8_t icons[ICON_NUM][ICON_SIZE] = {
+	{SPRITE_PAGE8(
+		0b10101001,
+		0b10101011,
+		0b11111011,
+		0b01110111,
+		0b00100111,
+		0b00100011,
+		0b00100001,
+		0b00100001
+	)},
+	{SPRITE_PAGE8(
+		0b01000010,
+		0b00011000,
+		0b10100101,
+		0b00100100,
+		0b00011000,
+		0b01000010,
+		0b00011000,
+		0b00000000
+	)},
+	{SPRITE_PAGE8(
+		0b11100111,
+		0b10101111,
+		0b11101111,
+		0b00011110,
+		0b00111000,
+		0b00110000,
+		0b11000000,
+		0b11000000
+	)},
+	{SPRITE_PAGE8(
+		0b00011100,
+		0b00001110,
+		0b00011111,
+		0b00110111,
+		0b01101101,
+		0b01111000,
+		0b11110000,
+		0b11000000
+	)},
+	{SPRITE_PAGE8(
+		0b01100000,
+		0b10010011,
+		0b10011101,
+		0b01010011,
+		0b01001101,
+		0b01000001,
+		0b01100011,
+		0b00111110
+	)},
+	{SPRITE_PAGE8(
+		0b00000000,
+		0b01111110,
+		0b10000001,
+		0b10101011,
+		0b10101011,
+		0b10010001,
+		0b01001010,
+		0b00111100
+	)},
+	{SPRITE_PAGE8(
+		0b00000000,
+		0b00000010,
+		0b00000101,
+		0b01110101,
+		0b11100101,
+		0b11001010,
+		0b11100000,
+		0b01110000
+	)},
+	{SPRITE_PAGE8(
+		0b00000000,
+		0b01110000,
+		0b10001000,
+		0b11011110,
+		0b10100101,
+		0b01111011,
+		0b00010001,
+		0b00001110
+	)},
+};
+
+static const uint8_t battery_body[((BATTERY_H + 7) >> 3) * BATTERY_W] = {
+	SPRITE_PAGE12(
+		0b000111111000,
+		0b000111111000,
+		0b111111111111,
+		0b111111111111,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011
+	),
+	SPRITE_PAGE12(
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011
+	),
+	SPRITE_PAGE12(
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b110000000011,
+		0b111111111111,
+		0b111111111111,
+		0,
+		0
+	),
+};
+
+static const uint8_t battery_level[BATTERY_LVL_W] = {
+	SPRITE_PAGE6(
+		0b111111,
+		0b111111,
+		0, 0, 0, 0, 0, 0
+	),
+};
+
+static const uint8_t battery_bolt[BATTERY_BOLT_W] = {
+	SPRITE_PAGE4(
+		0b1100,
+		0b1100,
+		0b1111,
+		0b1111,
+		0b0011,
+		0b0011,
+		0,
+		0
+	),
 };
 
+static void render_job_fn(job_t *job);
 static void battery_job_fn(job_t *job);
 static void autosave_job_fn(job_t *job);
 static void autooff_job_fn(job_t *job);
+static void suspend_job_fn(job_t *job);
+static void idle_job_fn(job_t *job);
+static void idle_resume(void);
 
 
 static void update_led(void)
@@ -274,28 +485,59 @@ static void hal_log(log_level_t level, char *buff, ...)
 {
 }
 
-static timestamp_t hal_get_timestamp(void)
+static void render_request(void)
 {
-	return (timestamp_t) (time_get() << time_shift);
+	mcu_time_t time = render_time + (MS_TO_MCU_TIME(1000)/FRAMERATE) * (speed_levels[speed_level].frame_skip + 1);
+
+	if (power_off_mode || idle_suspended) {
+		return;
+	}
+
+	/* Keep an earlier render, the frame rate being capped anyway */
+	if (render_job.queued && (render_job.time == JOB_ASAP || (int32_t) (render_job.time - time) <= 0)) {
+		return;
+	}
+
+	job_schedule(&render_job, &render_job_fn, time);
 }
 
-static void hal_sleep_until(timestamp_t ts)
+static void screen_invalidate(void)
 {
-	/* Since TamaLIB is always late in implementations without mainloop,
-	 * notify the cpu job that TamaLIB catched up instead of waiting
-	 */
-	if ((int32_t) (ts - hal_get_timestamp()) > 0) {
-		tamalib_is_late = 0;
-	}
+	screen_dirty = 1;
+	render_request();
+}
+
+static void lcd_snapshot(void)
+{
+	memcpy(frame_matrix, matrix_buffer, sizeof(frame_matrix));
+	memcpy(frame_icons, icon_buffer, sizeof(frame_icons));
+	lcd_changed = 0;
+	lcd_layer_dirty = 1;
+	screen_dirty = 1;
 }
 
 static void hal_update_screen(void)
 {
+	/* Frame boundary, the LCD being in a consistent state */
+	if (lcd_changed) {
+		lcd_snapshot();
+		render_request();
+	}
 }
 
 static void hal_set_lcd_matrix(u8_t x, u8_t y, bool_t val)
 {
-	matrix_buffer[y][x] = val;
+	uint32_t row = matrix_buffer[y];
+
+	if (val) {
+		matrix_buffer[y] |= (1UL << x);
+	} else {
+		matrix_buffer[y] &= ~(1UL << x);
+	}
+
+	if (matrix_buffer[y] != row) {
+		lcd_changed = 1;
+	}
 }
 
 static void hal_set_lcd_icon(u8_t icon, bool_t val)
@@ -311,6 +553,10 @@ static void hal_set_lcd_icon(u8_t icon, bool_t val)
 		update_led();
 	}
 
+	if (icon_buffer[icon] != val) {
+		lcd_changed = 1;
+	}
+
 	icon_buffer[icon] = val;
 }
 
@@ -321,7 +567,8 @@ static void hal_set_frequency(u32_t freq)
 
 static void hal_play_frequency(bool_t en)
 {
-	speaker_enable((uint8_t) (en && config.speaker_enabled));
+	/* The catch-up is silent */
+	speaker_enable((uint8_t) (en && config.speaker_enabled && !catchup_remaining));
 }
 
 static int hal_handler(void)
@@ -335,8 +582,8 @@ static hal_t hal = {
 	.halt = &hal_halt,
 	.is_log_enabled = &hal_is_log_enabled,
 	.log = &hal_log,
-	.sleep_until = &hal_sleep_until,
-	.get_timestamp = &hal_get_timestamp,
+	.sleep_until = &emu_sleep_until,
+	.get_timestamp = &emu_get_timestamp,
 	.update_screen = &hal_update_screen,
 	.set_lcd_matrix = &hal_set_lcd_matrix,
 	.set_lcd_icon = &hal_set_lcd_icon,
@@ -345,38 +592,23 @@ static hal_t hal = {
 	.handler = &hal_handler,
 };
 
-static void draw_icon(uint8_t x, uint8_t y, uint8_t num, color_t color)
+static void draw_icon(uint8_t x, uint8_t y, uint8_t num)
 {
-	uint8_t i, j;
-
-	for (j = 0; j < ICON_SIZE; j++) {
-		for (i = 0; i < ICON_SIZE; i++) {
-			if(icons[num][j][i]) {
-				gfx_pixel(x + i, y + j, color);
-			}
-		}
-	}
+	gfx_blit(icons[num], x, y, ICON_SIZE, ICON_SIZE);
 }
 
-static void draw_battery(uint8_t x, uint8_t y, uint8_t w, uint8_t thickness, uint8_t level_thickness, uint8_t max_level, uint8_t level)
+static void draw_battery(uint8_t x, uint8_t y, uint8_t level)
 {
-	uint8_t h = max_level * (level_thickness + 1) + 1 + 3 * thickness;
 	uint8_t i;
 
-	/* Body */
-	gfx_square(x, y + thickness, thickness, h - thickness, COLOR_ON_BLACK);
-	gfx_square(x + w - thickness, y + thickness, thickness, h - thickness, COLOR_ON_BLACK);
-	gfx_square(x + thickness, y + thickness, w - thickness * 2, thickness, COLOR_ON_BLACK);
-	gfx_square(x + thickness, y + h - thickness, w - thickness * 2, thickness, COLOR_ON_BLACK);
-	gfx_square(x + w/4, y, w/2, thickness, COLOR_ON_BLACK);
+	gfx_blit(battery_body, x, y, BATTERY_W, BATTERY_H);
 
-	/* Level */
 	for (i = 0; i < level; i++) {
-		gfx_square(x + thickness + 1, y + h - thickness - (i + 1) * (level_thickness + 1), w - thickness * 2 - 2, level_thickness, COLOR_ON_BLACK);
+		gfx_blit(battery_level, x + BATTERY_LVL_X, y + BATTERY_LVL_Y - i * BATTERY_LVL_STRIDE, BATTERY_LVL_W, BATTERY_LVL_H);
 	}
 }
 
-static void draw_battery_full(uint8_t x, uint8_t y)
+static uint8_t get_battery_level(void)
 {
 	int8_t level = (((int32_t) current_battery - BATTERY_MIN) * (BATTERY_MAX_LEVEL + 1))/(BATTERY_MAX - BATTERY_MIN);
 
@@ -388,50 +620,182 @@ static void draw_battery_full(uint8_t x, uint8_t y)
 		level = 0;
 	}
 
-	draw_battery(x, y, BATTERY_W, BATTERY_THICKNESS, BATTERY_LVL_THICKNESS, BATTERY_MAX_LEVEL, level);
+	return level;
+}
+
+static void draw_battery_full(uint8_t x, uint8_t y)
+{
+	draw_battery(x, y, get_battery_level());
 
 	if (is_charging) {
-		gfx_square(x + BATTERY_W/2 - 2, y - 1 - 3 * 2, 2, 4, COLOR_ON_BLACK);
-		gfx_square(x + BATTERY_W/2, y - 1 - 2 * 2, 2, 4, COLOR_ON_BLACK);
+		gfx_blit(battery_bolt, x + BATTERY_BOLT_X, y + BATTERY_BOLT_Y, BATTERY_BOLT_W, BATTERY_BOLT_H);
 	}
 }
 
+#ifdef LCD_COLUMN_MIN_DOTS
+static uint8_t count_dots(uint32_t row)
+{
+	uint8_t dots = 0;
+
+	for (; row != 0; row >>= 4) {
+		dots += nibble_dots[row & 0xF];
+	}
+
+	return dots;
+}
+#endif
+
 static void tamalib_screen(void)
 {
 	u8_t i, j;
+	uint32_t used = 0;
+	uint16_t col;
+	uint64_t bits;
+#ifdef LCD_COLUMN_MIN_DOTS
+	uint32_t row;
+	uint16_t dots = 0;
+#endif
 
-	/* Dot matrix */
 	for (j = 0; j < LCD_HEIGHT; j++) {
-		for (i = 0; i < LCD_WIDTH; i++) {
-			if (matrix_buffer[j][i]) {
+		used |= frame_matrix[j];
+#ifdef LCD_COLUMN_MIN_DOTS
+		dots += count_dots(frame_matrix[j]);
+#endif
+	}
+
+#ifdef LCD_COLUMN_MIN_DOTS
+	if (dots < count_dots(used) * LCD_COLUMN_MIN_DOTS) {
+		/* Sparse dot matrix, only visiting the pixels that are on */
+		for (j = 0; j < LCD_HEIGHT; j++) {
+			for (row = frame_matrix[j]; row != 0; row &= row - 1) {
+				i = __builtin_ctz(row);
 				gfx_square(i * PIXEL_SIZE + LCD_OFFET_X, j * PIXEL_SIZE + LCD_OFFET_Y, PIXEL_SIZE, PIXEL_SIZE, COLOR_ON_BLACK);
 			}
 		}
+
+		/* No column left to draw */
+		used = 0;
+	}
+#endif
+
+	/* Dense dot matrix, drawn by columns of scaled pixels, skipping the empty ones */
+	for (; used != 0; used &= used - 1) {
+		i = __builtin_ctz(used);
+
+		col = 0;
+		for (j = 0; j < LCD_HEIGHT; j++) {
+			col |= ((frame_matrix[j] >> i) & 0x1) << j;
+		}
+
+		bits = 0;
+		for (j = 0; j < LCD_HEIGHT; j += 4) {
+			bits |= (uint64_t) scale_lut[(col >> j) & 0xF] << (j * PIXEL_SIZE);
+		}
+
+		gfx_column(i * PIXEL_SIZE + LCD_OFFET_X, LCD_OFFET_Y, bits, PIXEL_SIZE);
 	}
 
 	/* Icons */
 	for (i = 0; i < ICON_NUM; i++) {
-		if (icon_buffer[i]) {
-			draw_icon((i % 4) * ICON_STRIDE_X + ICON_OFFSET_X, (i / 4) * ICON_STRIDE_Y + ICON_OFFSET_Y, i, COLOR_ON_BLACK);
+		if (frame_icons[i]) {
+			draw_icon((i % 4) * ICON_STRIDE_X + ICON_OFFSET_X, (i / 4) * ICON_STRIDE_Y + ICON_OFFSET_Y, i);
 		}
 	}
 }
 
+static void screen_job_fn(job_t *job)
+{
+	gfx_display_done();
+}
+
+static void screen_window_sent(void)
+{
+	/* Called from the SPI DMA IRQ */
+	job_schedule(&screen_job, &screen_job_fn, JOB_ASAP);
+}
+
+#if defined(BOARD_HAS_SSD1306) && defined(SCREEN_CROP_ROWS)
+static void screen_rows(uint8_t first, uint8_t count)
+{
+	if (config.lcd_inverted) {
+		/* The rows that are not driven stay off */
+		first = 0;
+		count = DISPLAY_HEIGHT;
+	}
+
+	ssd1306_set_rows(first, count);
+}
+#endif
+
+static void screen_ready(void)
+{
+	/* The screen is configured, whatever has been drawn meanwhile can be shown */
+#if defined(BOARD_HAS_SSD1306)
+	ssd1306_register_window_cb(&screen_window_sent);
+	gfx_register_display(&ssd1306_send_window, 1);
+#ifdef SCREEN_CROP_ROWS
+	gfx_register_rows(&screen_rows);
+#endif
+#elif defined(BOARD_HAS_UC1701X)
+	uc1701x_register_window_cb(&screen_window_sent);
+	gfx_register_display(&uc1701x_send_window, 1);
+#endif
+
+	gfx_print_screen();
+}
+
+static void screen_flush(void)
+{
+	/* The caller is about to block, the rest of the frame cannot wait for the jobs */
+	while (gfx_is_sending()) {
+		spi_wait();
+		job_cancel(&screen_job);
+		gfx_display_done();
+	}
+}
+
 static void please_wait_screen(void)
 {
+	screen_invalidate();
+	menu_invalidate();
+
 	gfx_clear();
 
 	gfx_string(PLEASE_WAIT_STR, PLEASE_WAIT_X, PLEASE_WAIT_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
 
 	gfx_print_screen();
+	screen_flush();
 }
 
 static void autosaving_screen(void)
 {
+	screen_invalidate();
+
 	gfx_clear();
 
 	gfx_string(AUTOSAVING_STR, AUTOSAVING_X, AUTOSAVING_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
 
+	gfx_print_screen();
+	screen_flush();
+}
+
+static void catchup_screen(void)
+{
+	uint8_t w = ((catchup_total - catchup_remaining) * (CATCHUP_BAR_W - 4))/catchup_total;
+
+	screen_dirty = 1;
+
+	gfx_clear();
+
+	gfx_string(CATCHUP_STR, CATCHUP_X, CATCHUP_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
+
+	/* Progress bar */
+	gfx_square(CATCHUP_BAR_X, CATCHUP_BAR_Y, CATCHUP_BAR_W, 1, COLOR_ON_BLACK);
+	gfx_square(CATCHUP_BAR_X, CATCHUP_BAR_Y + CATCHUP_BAR_H - 1, CATCHUP_BAR_W, 1, COLOR_ON_BLACK);
+	gfx_square(CATCHUP_BAR_X, CATCHUP_BAR_Y, 1, CATCHUP_BAR_H, COLOR_ON_BLACK);
+	gfx_square(CATCHUP_BAR_X + CATCHUP_BAR_W - 1, CATCHUP_BAR_Y, 1, CATCHUP_BAR_H, COLOR_ON_BLACK);
+	gfx_square(CATCHUP_BAR_X + 2, CATCHUP_BAR_Y + 2, w, CATCHUP_BAR_H - 4, COLOR_ON_BLACK);
+
 	gfx_print_screen();
 }
 
@@ -452,6 +816,16 @@ static void backlight_job_fn(job_t *job)
 {
 	backlight_set(0);
 	is_backlight_on = 0;
+
+#if defined(BOARD_HAS_SSD1306)
+	/* The OLED current follows the contrast, which is ramped down step by step */
+	screen_contrast = (screen_contrast > CONTRAST_DIM + CONTRAST_STEP) ? screen_contrast - CONTRAST_STEP : CONTRAST_DIM;
+	ssd1306_set_contrast(screen_contrast);
+
+	if (screen_contrast > CONTRAST_DIM) {
+		job_schedule_next(&backlight_job, MS_TO_MCU_TIME(CONTRAST_STEP_PERIOD));
+	}
+#endif
 }
 
 static void turn_on_backlight(bool_t force)
@@ -459,6 +833,11 @@ static void turn_on_backlight(bool_t force)
 	if (!is_backlight_on || force) {
 		backlight_set((config.backlight_level < 16) ? config.backlight_level * 16 : 255);
 		is_backlight_on = 1;
+
+#if defined(BOARD_HAS_SSD1306)
+		screen_contrast = SSD1306_CONTRAST_DEFAULT;
+		ssd1306_set_contrast(screen_contrast);
+#endif
 	}
 
 	if (!config.backlight_always_on) {
@@ -468,11 +847,21 @@ static void turn_on_backlight(bool_t force)
 
 static void user_feedback(void)
 {
+	if (idle_suspended) {
+		/* Someone is back */
+		idle_resume();
+	}
+
 	/* Delay auto-power-off (only if no ROM is loaded) */
 	if (!rom_loaded && !usb_enabled && !power_off_mode) {
 		job_schedule(&autooff_job, &autooff_job_fn, time_get() + MS_TO_MCU_TIME(AUTOOFF_PERIOD));
 	}
 
+	/* Delay the idle suspend (only if a ROM is loaded) */
+	if (rom_loaded && !power_off_mode) {
+		job_schedule(&idle_job, &idle_job_fn, time_get() + MS_TO_MCU_TIME(IDLE_SUSPEND_PERIOD));
+	}
+
 	/* Turn ON the backlight for few seconds */
 	turn_on_backlight(0);
 }
@@ -485,7 +874,7 @@ static void enable_usb(void)
 	}
 
 	emulation_paused = 1;
-	tamalib_set_exec_mode(emulation_paused ? EXEC_MODE_PAUSE : EXEC_MODE_RUN);
+	emu_set_paused(emulation_paused);
 
 	fs_ll_umount();
 
@@ -505,7 +894,7 @@ static void disable_usb(void)
 	fs_ll_mount();
 
 	emulation_paused = 0;
-	tamalib_set_exec_mode(emulation_paused ? EXEC_MODE_PAUSE : EXEC_MODE_RUN);
+	emu_set_paused(emulation_paused);
 
 	/* Enable auto-power-off if needed */
 	if (!rom_loaded) {
@@ -513,10 +902,24 @@ static void disable_usb(void)
 	}
 }
 
+static void suspend_update(void)
+{
+	mcu_time_t now = time_get();
+
+	suspend_info.elapsed += now - suspend_time;
+	suspend_time = now;
+}
+
 static void power_on(void)
 {
 	power_off_mode = 0;
 
+	if (suspended) {
+		/* Let the next boot catch up with the time spent powered off */
+		suspend_update();
+		suspend_info.magic = SUSPEND_MAGIC;
+	}
+
 	/* Just a reset for now */
 	system_reset();
 }
@@ -543,14 +946,26 @@ static void power_off(void)
 		/* Save the current configuration */
 		config_save(&config);
 
+		/* Bring a halted CPU up to date before saving its state */
+		emu_wake();
+		suspend_time = time_get();
+
 		if (config.autosave_enabled) {
 			/* Save the current state and disable autosave */
 			state_save(AUTOSAVE_SLOT);
 			job_cancel(&autosave_job);
+
+			if (rom_loaded && !emulation_paused) {
+				/* Keep track of the time spent powered off, including what was left to catch up */
+				suspend_info.elapsed = (catchup_remaining * MCU_TIME_FREQ_X1000)/(TAMALIB_FREQ * 1000);
+				suspended = 1;
+				job_schedule(&suspend_job, &suspend_job_fn, suspend_time + MS_TO_MCU_TIME(SUSPEND_JOB_PERIOD));
+			}
 		}
 
+		catchup_remaining = 0;
 		emulation_paused = 1;
-		tamalib_set_exec_mode(emulation_paused ? EXEC_MODE_PAUSE : EXEC_MODE_RUN);
+		emu_set_paused(emulation_paused);
 
 		fs_ll_umount();
 
@@ -567,7 +982,12 @@ static void power_off(void)
 		is_backlight_on = 0;
 
 		job_cancel(&render_job);
-		job_cancel(&cpu_job);
+		job_cancel(&catchup_job);
+		job_cancel(&idle_job);
+		emu_stop();
+#ifdef PROFILER
+		job_cancel(&prof_job);
+#endif
 	}
 
 	/* Turn OFF backlight */
@@ -607,6 +1027,11 @@ static void menu_screen_mode(uint8_t pos, menu_parent_t *parent)
 {
 	config.lcd_inverted = !config.lcd_inverted;
 #if defined(BOARD_HAS_SSD1306)
+#ifdef SCREEN_CROP_ROWS
+	/* All the rows are driven while inverted, and the span is computed again otherwise */
+	ssd1306_set_rows(0, DISPLAY_HEIGHT);
+	gfx_register_rows(&screen_rows);
+#endif
 	ssd1306_set_display_mode(config.lcd_inverted ? DISP_MODE_INVERTED : DISP_MODE_NORMAL);
 #elif defined(BOARD_HAS_UC1701X)
 	uc1701x_set_display_mode(config.lcd_inverted ? DISP_MODE_INVERTED : DISP_MODE_NORMAL);
@@ -707,26 +1132,19 @@ static char * menu_battery_arg(uint8_t pos, menu_parent_t *parent)
 
 static void menu_toggle_speed(uint8_t pos, menu_parent_t *parent)
 {
-	speed_ratio = !speed_ratio;
-	tamalib_set_speed(speed_ratio);
+	speed_level = (speed_level + 1) % SPEED_LEVEL_NUM;
+	emu_set_speed(speed_levels[speed_level].ratio, speed_levels[speed_level].cpu_share);
 }
 
 static char * menu_toggle_speed_arg(uint8_t pos, menu_parent_t *parent)
 {
-	switch (speed_ratio) {
-		case 0:
-			return "[Max]";
-
-		default:
-		case 1:
-			return " [x1]";
-	}
+	return speed_levels[speed_level].name;
 }
 
 static void menu_pause(uint8_t pos, menu_parent_t *parent)
 {
 	emulation_paused = !emulation_paused;
-	tamalib_set_exec_mode(emulation_paused ? EXEC_MODE_PAUSE : EXEC_MODE_RUN);
+	emu_set_paused(emulation_paused);
 }
 
 static char * menu_pause_arg(uint8_t pos, menu_parent_t *parent)
@@ -741,6 +1159,16 @@ static char * menu_pause_arg(uint8_t pos, menu_parent_t *parent)
 	}
 }
 
+static void menu_idle_suspend(uint8_t pos, menu_parent_t *parent)
+{
+	idle_suspend_enabled = !idle_suspend_enabled;
+}
+
+static char * menu_idle_suspend_arg(uint8_t pos, menu_parent_t *parent)
+{
+	return menu_toggle_arg(idle_suspend_enabled);
+}
+
 static char * menu_vbat_arg(uint8_t pos, menu_parent_t *parent)
 {
 	static char str[] = "0.00 V";
@@ -760,7 +1188,7 @@ static void menu_power_off(uint8_t pos, menu_parent_t *parent)
 
 static void menu_reset_cpu(uint8_t pos, menu_parent_t *parent)
 {
-	cpu_reset();
+	emu_reset();
 	menu_close();
 }
 
@@ -791,12 +1219,137 @@ static void menu_reset_device(uint8_t pos, menu_parent_t *parent)
 	system_reset();
 }
 
+#ifdef JOB_STATS
+static void menu_stats_mode(uint8_t pos, menu_parent_t *parent)
+{
+	stats_mode = (stats_mode + 1) % STATS_MODE_NUM;
+}
+
+static char * menu_stats_mode_arg(uint8_t pos, menu_parent_t *parent)
+{
+	switch (stats_mode) {
+		default:
+		case STATS_MODE_LATE_MAX:
+			return "Late";
+
+		case STATS_MODE_RUN_MAX:
+			return "Run";
+
+		case STATS_MODE_RUNS:
+			return "Count";
+	}
+}
+
+static char * stats_value_str(uint32_t v, uint8_t decimal)
+{
+	static char str[] = "00000";
+	uint8_t i;
+
+	if (v > 99999) {
+		v = 99999;
+	}
+
+	/* Right-aligned, from the last digit */
+	for (i = 0; i < sizeof(str) - 1; i++) {
+		if (decimal && i == 1) {
+			str[sizeof(str) - 2 - i] = '.';
+		} else if (v > 0 || i == 0 || (decimal && i == 2)) {
+			str[sizeof(str) - 2 - i] = '0' + v % 10;
+			v /= 10;
+		} else {
+			str[sizeof(str) - 2 - i] = ' ';
+		}
+	}
+
+	return str;
+}
+
+static char * menu_stats_job_arg(uint8_t pos, menu_parent_t *parent)
+{
+	job_t *j = NULL;
+	uint8_t i;
+
+	/* The first item is the mode */
+	for (i = 0; i < pos; i++) {
+		j = job_stats_get_next(j);
+	}
+
+	switch (stats_mode) {
+		default:
+		case STATS_MODE_LATE_MAX:
+			/* Milliseconds with one decimal */
+			return stats_value_str(MCU_TIME_TO_US((uint64_t) j->stats.late_max)/100, 1);
+
+		case STATS_MODE_RUN_MAX:
+			/* Milliseconds with one decimal */
+			return stats_value_str(MCU_TIME_TO_US((uint64_t) j->stats.run_max)/100, 1);
+
+		case STATS_MODE_RUNS:
+			return stats_value_str(j->stats.runs, 0);
+	}
+}
+
+static char * menu_stats_wakeups_arg(uint8_t pos, menu_parent_t *parent)
+{
+	const job_sleep_stats_t *s = job_stats_get_sleep();
+	uint64_t elapsed = MCU_TIME_TO_US((uint64_t) (time_get() - s->since))/100000;
+
+	/* Wakeups per second with one decimal */
+	return stats_value_str((elapsed > 0) ? (s->wakeups * 100ULL)/elapsed : 0, 1);
+}
+
+static char * menu_stats_s3_arg(uint8_t pos, menu_parent_t *parent)
+{
+	const job_sleep_stats_t *s = job_stats_get_sleep();
+	mcu_time_t elapsed = time_get() - s->since;
+
+	/* Percentage with one decimal */
+	return stats_value_str((elapsed > 0) ? (s->residency[STATE_SLEEP_S3] * 1000ULL)/elapsed : 0, 1);
+}
+
+static char * menu_stats_skipped_arg(uint8_t pos, menu_parent_t *parent)
+{
+	/* Percentage of the frames that did not need to be redrawn, with one decimal */
+	return stats_value_str((frames_total > 0) ? (frames_skipped * 1000ULL)/frames_total : 0, 1);
+}
+
+static void menu_stats_dump(uint8_t pos, menu_parent_t *parent)
+{
+	please_wait_screen();
+
+	stats_dump();
+}
+
+static void menu_stats_reset(uint8_t pos, menu_parent_t *parent)
+{
+	job_stats_reset();
+
+	frames_total = 0;
+	frames_skipped = 0;
+}
+#endif
+
+#ifdef PROFILER
+static void menu_prof_dump(uint8_t pos, menu_parent_t *parent)
+{
+	please_wait_screen();
+
+	prof_dump();
+}
+
+static void menu_prof_reset(uint8_t pos, menu_parent_t *parent)
+{
+	prof_reset();
+}
+#endif
+
 static void menu_slots(uint8_t pos, menu_parent_t *parent)
 {
 	please_wait_screen();
 
 	if (parent->pos == 0) {
 		/* Load */
+		emu_wake();
 		state_load(pos);
 		menu_close();
 	} else if (parent->pos == 1) {
@@ -852,11 +1405,14 @@ static void menu_roms(uint8_t pos, menu_parent_t *parent)
 {
 	please_wait_screen();
 
+	/* The pending wakeup was computed for the ROM being replaced */
+	emu_wake();
+
 	if (rom_load(pos) < 0) {
 		return;
 	}
 
-	cpu_reset();
+	emu_reset();
 	menu_close();
 }
 
@@ -904,15 +1460,28 @@ static menu_item_t interface_menu[] = {
 static menu_item_t emulation_menu[] = {
 	{"Speed  ", &menu_toggle_speed_arg, &menu_toggle_speed, 0, NULL},
 	{"", &menu_pause_arg, &menu_pause, 0, NULL},
+	{"Idle Stop ", &menu_idle_suspend_arg, &menu_idle_suspend, 0, NULL},
 	{"Reset CPU", NULL, &menu_reset_cpu, 1, NULL},
 
 	{NULL, NULL, NULL, 0, NULL},
 };
 
+#ifdef JOB_STATS
+/* Filled at boot time, once all the jobs are named */
+static menu_item_t stats_menu[STATS_MENU_SIZE + 1];
+#endif
+
 static menu_item_t system_menu[] = {
 	{"Batt. ", &menu_vbat_arg, NULL, 0, NULL},
 	{"FW. "FIRMWARE_VERSION, NULL, NULL, 0, NULL},
 	{"FW. Update", NULL, &menu_firmware_update, 1, NULL},
+#ifdef JOB_STATS
+	{"Stats", NULL, NULL, 0, stats_menu},
+#endif
+#ifdef PROFILER
+	{"Prof. Dump", NULL, &menu_prof_dump, 0, NULL},
+	{"Prof. Reset", NULL, &menu_prof_reset, 1, NULL},
+#endif
 	{"Power OFF", NULL, &menu_power_off, 1, NULL},
 	{"Reset", NULL, &menu_reset_device, 1, NULL},
 	{"Fact. Reset", NULL, &menu_factory_reset, 1, NULL},
@@ -965,6 +1534,40 @@ static menu_item_t main_menu[] = {
 	{NULL, NULL, NULL, 0, NULL},
 };
 
+#ifdef JOB_STATS
+static void stats_menu_init(void)
+{
+	job_t *j = NULL;
+	uint8_t n = 0;
+	uint8_t i;
+
+	stats_menu[n++] = (menu_item_t) {"Show  ", &menu_stats_mode_arg, &menu_stats_mode, 0, NULL};
+
+	/* One item per named job, as long as there is room for the last items */
+	while ((j = job_stats_get_next(j)) != NULL && n < STATS_MENU_SIZE - 5) {
+		for (i = 0; i < STATS_NAME_WIDTH - 1 && j->name[i] != '\0'; i++) {
+			stats_names[n][i] = j->name[i];
+		}
+
+		/* Pad up to the value */
+		for (; i < STATS_NAME_WIDTH; i++) {
+			stats_names[n][i] = ' ';
+		}
+		stats_names[n][STATS_NAME_WIDTH] = '\0';
+
+		stats_menu[n] = (menu_item_t) {stats_names[n], &menu_stats_job_arg, &menu_stats_mode, 0, NULL};
+		n++;
+	}
+
+	stats_menu[n++] = (menu_item_t) {"Wake/s ", &menu_stats_wakeups_arg, NULL, 0, NULL};
+	stats_menu[n++] = (menu_item_t) {"S3 %   ", &menu_stats_s3_arg, NULL, 0, NULL};
+	stats_menu[n++] = (menu_item_t) {"Skip % ", &menu_stats_skipped_arg, NULL, 0, NULL};
+	stats_menu[n++] = (menu_item_t) {"Dump", NULL, &menu_stats_dump, 0, NULL};
+	stats_menu[n++] = (menu_item_t) {"Reset", NULL, &menu_stats_reset, 1, NULL};
+	stats_menu[n] = (menu_item_t) {NULL, NULL, NULL, 0, NULL};
+}
+#endif
+
 static void ll_init(void)
 {
 	system_init();
@@ -981,18 +1584,11 @@ static void ll_init(void)
 
 	battery_init();
 
+	/* The screen is powered up in the background until the boot needs it */
 #if defined(BOARD_HAS_SSD1306)
-	ssd1306_init();
-	ssd1306_set_power_mode(PWR_MODE_ON);
-	ssd1306_set_display_mode(DISP_MODE_NORMAL);
-
-	gfx_register_display(&ssd1306_send_data);
+	ssd1306_init(&screen_ready);
 #elif defined(BOARD_HAS_UC1701X)
-	uc1701x_init();
-	uc1701x_set_power_mode(PWR_MODE_ON);
-	uc1701x_set_display_mode(DISP_MODE_NORMAL);
-
-	gfx_register_display(&uc1701x_send_data);
+	uc1701x_init(&screen_ready);
 #endif
 
 	/* Wait a little bit to make sure all I/Os are stable */
@@ -1022,22 +1618,80 @@ static void autosave_job_fn(job_t *job)
 	}
 }
 
+/* Everything drawn on top of the emulated LCD */
+static uint8_t get_overlay_state(void)
+{
+	uint8_t state = (usb_enabled << 0) | (emulation_paused << 1) | (rom_loaded << 2);
+
+	if (config.battery_enabled || current_battery < BATTERY_LOW || is_vbus) {
+		state |= (1 << 3) | (is_charging << 4) | (get_battery_level() << 5);
+	}
+
+	return state;
+}
+
 static void render_job_fn(job_t *job)
 {
-	job_schedule(&render_job, &render_job_fn, time_get() + MS_TO_MCU_TIME(1000)/FRAMERATE);
+	uint8_t overlay;
+
+	if (catchup_remaining > 0) {
+		/* The emulation is running headless, only show its progress */
+		job_schedule_next(&render_job, MS_TO_MCU_TIME(CATCHUP_RENDER_PERIOD));
+		catchup_screen();
+		return;
+	}
+
+	/* The frames are requested at the emulated frame boundaries, this is only
+	 * a fallback for the overlays
+	 */
+	job_schedule(&render_job, &render_job_fn, time_get() + MS_TO_MCU_TIME(OVERLAY_REFRESH_PERIOD));
+
+	if ((emulation_paused || !rom_loaded) && lcd_changed) {
+		/* No frame boundary to wait for */
+		lcd_snapshot();
+	}
 
 	if (menu_is_visible()) {
+		/* The menu owns the screen */
+		screen_dirty = 1;
 		return;
 	}
 
-	gfx_clear();
+	overlay = get_overlay_state();
 
-	if (!rom_loaded) {
-		no_rom_screen();
-	} else {
-		tamalib_screen();
+#ifdef JOB_STATS
+	frames_total++;
+#endif
+
+	if (!screen_dirty && overlay == screen_overlay) {
+		/* Same frame as the one on the screen */
+#ifdef JOB_STATS
+		frames_skipped++;
+#endif
+		return;
+	}
+
+	screen_dirty = 0;
+	screen_overlay = overlay;
+	render_time = time_get();
+
+	if (lcd_layer_dirty) {
+		lcd_layer_dirty = 0;
+
+		gfx_set_layer(lcd_layer);
+		gfx_clear();
+
+		if (!rom_loaded) {
+			no_rom_screen();
+		} else {
+			tamalib_screen();
+		}
+
+		gfx_set_layer(NULL);
 	}
 
+	gfx_copy_layer(lcd_layer);
+
 	if (usb_enabled) {
 		gfx_string(USBON_STR, USBON_X, USBON_Y, 1, COLOR_ON_BLACK, BACKGROUND_ON);
 	} else if (emulation_paused) {
@@ -1052,30 +1706,174 @@ static void render_job_fn(job_t *job)
 	gfx_print_screen();
 }
 
-static void cpu_job_fn(job_t *job)
+#ifdef PROFILER
+static void prof_job_fn(job_t *job)
 {
-	job_t *next_job;
+	state_t *state = tamalib_get_state();
+	u13_t pc = *(state->pc);
 
-	job_schedule(&cpu_job, &cpu_job_fn, time_get() + MS_TO_MCU_TIME(MAIN_JOB_PERIOD));
+	job_schedule_next(&prof_job, MS_TO_MCU_TIME(PROF_PERIOD));
 
-	tamalib_is_late = 1;
+	if (emulation_paused || catchup_remaining > 0 || idle_suspended) {
+		return;
+	}
 
-	/* Execute all the missed steps at once */
-	while (tamalib_is_late) {
-		tamalib_step();
+	/* The emulated PC is where the last cpu job left it, which is spread over the
+	 * ROM code by the batches at max speed, and by the real time at x1
+	 */
+	if (g_program[(pc - 1) & PC_MASK] == HALT_OPCODE) {
+		prof_sample(pc, PROF_SAMPLE_HALT);
+	} else if (!(*(state->flags) & FLAG_I)) {
+		prof_sample(pc, PROF_SAMPLE_INT);
+	} else {
+		prof_sample(pc, PROF_SAMPLE_RUN);
+	}
+}
+#endif
 
-		next_job = job_get_next();
-		if (next_job != NULL && next_job->time <= time_get()) {
-			/* No more time to execute instructions */
-			job_schedule(&cpu_job, &cpu_job_fn, next_job->time);
-			break;
+static void catchup_job_fn(job_t *job)
+{
+	state_t *state = tamalib_get_state();
+	mcu_time_t now = time_get();
+	u32_t start_tick = *(state->tick_counter);
+	u32_t target, next, done;
+	uint32_t n;
+	u13_t pc;
+	uint64_t ticks;
+
+	/* The real time keeps running during the catch-up */
+	ticks = ((uint64_t) (now - catchup_time) * TAMALIB_FREQ * 1000)/MCU_TIME_FREQ_X1000;
+	catchup_remaining += ticks;
+	catchup_total += ticks;
+	catchup_time = now;
+
+	target = start_tick + ((catchup_remaining > CATCHUP_CHUNK) ? CATCHUP_CHUNK : catchup_remaining);
+
+	/* Run at max speed for a slice of time, so that the other jobs are not delayed too much */
+	do {
+		for (n = CATCHUP_BATCH; n > 0 && (int32_t) (*(state->tick_counter) - target) < 0; n--) {
+			pc = *(state->pc);
+			tamalib_step();
+
+			if (*(state->pc) == pc && g_program[(pc - 1) & PC_MASK] == HALT_OPCODE) {
+				/* Same as the cpu job, the frame being rendered once caught up */
+				if (lcd_changed) {
+					lcd_snapshot();
+				}
+
+				/* Without going further than the target */
+				next = emu_get_next_int_tick(state);
+				*(state->tick_counter) = ((int32_t) (next - target) < 0) ? next : target;
+			}
 		}
+	} while ((int32_t) (*(state->tick_counter) - target) < 0 && (time_get() - now) < MS_TO_MCU_TIME(CATCHUP_SLICE));
+
+	done = *(state->tick_counter) - start_tick;
+	catchup_remaining = (done < catchup_remaining) ? catchup_remaining - done : 0;
+
+	if (catchup_remaining > 0) {
+		job_schedule(&catchup_job, &catchup_job_fn, time_get());
+		return;
+	}
+
+	/* Back to real time, TamaLIB being where the real time was when this slice started */
+	emu_set_speed(speed_levels[speed_level].ratio, speed_levels[speed_level].cpu_share);
+	emu_sync(catchup_time);
+
+	emu_start();
+	job_schedule(&render_job, &render_job_fn, JOB_ASAP);
+}
+
+static void catchup_start(uint64_t elapsed)
+{
+	catchup_remaining = (elapsed * TAMALIB_FREQ * 1000)/MCU_TIME_FREQ_X1000;
+	catchup_total = catchup_remaining;
+
+	/* Including the time spent booting */
+	catchup_time = 0;
+
+	/* TamaLIB does not wait at max speed */
+	tamalib_set_speed(0);
+}
+
+static void suspend_job_fn(job_t *job)
+{
+	job_schedule_next(&suspend_job, MS_TO_MCU_TIME(SUSPEND_JOB_PERIOD));
+
+	/* Accumulate the elapsed time before the MCU time wraps */
+	suspend_update();
+}
+
+static void idle_suspend(void)
+{
+	/* TamaLIB stays where the real time is when stopped */
+	emu_wake();
+	emu_stop();
+
+	/* Nothing new to save until the emulation is caught up */
+	job_cancel(&autosave_job);
+	job_cancel(&render_job);
+
+	backlight_set(0);
+	is_backlight_on = 0;
+	job_cancel(&backlight_job);
+
+#if defined(BOARD_HAS_SSD1306)
+	ssd1306_set_power_mode(PWR_MODE_SLEEP);
+#elif defined(BOARD_HAS_UC1701X)
+	uc1701x_set_power_mode(PWR_MODE_SLEEP);
+#endif
+
+	/* Only the suspend job is left to wake the MCU up */
+	suspend_info.elapsed = 0;
+	suspend_time = time_get();
+	job_schedule(&suspend_job, &suspend_job_fn, suspend_time + MS_TO_MCU_TIME(SUSPEND_JOB_PERIOD));
+
+	idle_suspended = 1;
+}
+
+static void idle_resume(void)
+{
+	idle_suspended = 0;
+
+	job_cancel(&suspend_job);
+	suspend_update();
+
+#if defined(BOARD_HAS_SSD1306)
+	ssd1306_set_power_mode(PWR_MODE_ON);
+#elif defined(BOARD_HAS_UC1701X)
+	uc1701x_set_power_mode(PWR_MODE_ON);
+#endif
+
+	/* Same catch-up as after a power off, from the time the emulation stopped */
+	catchup_start(suspend_info.elapsed);
+	catchup_time = suspend_time;
+	job_schedule(&catchup_job, &catchup_job_fn, JOB_ASAP);
+
+	if (config.autosave_enabled) {
+		job_schedule(&autosave_job, &autosave_job_fn, time_get() + MS_TO_MCU_TIME(AUTOSAVE_PERIOD));
 	}
+
+	screen_invalidate();
+}
+
+static void idle_job_fn(job_t *job)
+{
+	/* Only at x1, where the CPU keeps waking up for the emulation, and never
+	 * while the pet calls for attention
+	 */
+	if (!idle_suspend_enabled || speed_levels[speed_level].ratio != 1 || emulation_paused ||
+		usb_enabled || menu_is_visible() || catchup_remaining > 0 || is_calling) {
+		job_schedule_next(&idle_job, MS_TO_MCU_TIME(IDLE_SUSPEND_PERIOD));
+		return;
+	}
+
+	idle_suspend();
 }
 
 static void battery_job_fn(job_t *job)
 {
-	job_schedule(&battery_job, &battery_job_fn, time_get() + MS_TO_MCU_TIME(BATTERY_JOB_PERIOD));
+	job_schedule_next(&battery_job, MS_TO_MCU_TIME(BATTERY_JOB_PERIOD));
 
 	battery_start_meas();
 }
@@ -1089,6 +1887,8 @@ static void battery_cb(uint16_t v)
 
 	if (power_off_mode) {
 		/* The device is "OFF", update the battery icon */
+		screen_dirty = 1;
+
 		gfx_clear();
 
 		draw_battery_full(BATTERY_OFF_X, BATTERY_OFF_Y);
@@ -1100,6 +1900,9 @@ static void battery_cb(uint16_t v)
 		/* Battery is critical */
 		power_off();
 	}
+
+	/* The battery gauge might have changed */
+	render_request();
 }
 
 static void power_off_handler(input_t btn, input_state_t state, uint8_t long_press)
@@ -1165,9 +1968,11 @@ static void default_btn_handler(input_t btn, input_state_t state, uint8_t long_p
 			menu_open();
 
 			/* Make sure TamaLIB receives a release since it received a press */
+			emu_wake();
 			tamalib_set_button(btn, BTN_STATE_RELEASED);
 		}
 	} else {
+		emu_wake();
 		tamalib_set_button(btn, state);
 	}
 }
@@ -1219,6 +2024,11 @@ static void input_handler(input_t input, input_state_t state, uint8_t long_press
 		case INPUT_BTN_RIGHT:
 			if (power_off_mode) {
 				power_off_handler(input, state, long_press);
+			} else if (idle_suspended) {
+				/* The button only wakes the device up, and is not given to TamaLIB */
+				user_feedback();
+			} else if (catchup_remaining > 0) {
+				/* The buttons are ignored while catching up */
 			} else if (usb_enabled) {
 				usb_mode_btn_handler(input, state, long_press);
 			} else if (menu_is_visible()) {
@@ -1236,6 +2046,9 @@ static void input_handler(input_t input, input_state_t state, uint8_t long_press
 			vbus_sensing_handler(state);
 			break;
 	}
+
+	/* The overlays or the menu might have changed */
+	render_request();
 }
 
 static void states_init(void)
@@ -1257,16 +2070,34 @@ static void states_init(void)
 
 int main(void)
 {
+	job_set_name(&catchup_job, "catchup");
+	job_set_name(&render_job, "render");
+	job_set_name(&battery_job, "batt");
+	job_set_name(&backlight_job, "blight");
+	job_set_name(&autosave_job, "asave");
+	job_set_name(&autooff_job, "aoff");
+	job_set_name(&suspend_job, "susp");
+	job_set_name(&idle_job, "idle");
+	job_set_name(&screen_job, "screen");
+#ifdef PROFILER
+	job_set_name(&prof_job, "prof");
+#endif
+
+	job_set_slack(&render_job, MS_TO_MCU_TIME(RENDER_JOB_SLACK));
+	job_set_slack(&battery_job, MS_TO_MCU_TIME(BATTERY_JOB_SLACK));
+	job_set_slack(&backlight_job, MS_TO_MCU_TIME(BACKLIGHT_OFF_SLACK));
+	job_set_slack(&autosave_job, MS_TO_MCU_TIME(AUTOSAVE_SLACK));
+	job_set_slack(&autooff_job, MS_TO_MCU_TIME(AUTOOFF_SLACK));
+	job_set_slack(&suspend_job, MS_TO_MCU_TIME(SUSPEND_JOB_SLACK));
+	job_set_slack(&idle_job, MS_TO_MCU_TIME(IDLE_SUSPEND_SLACK));
+
 	ll_init();
 
 	/* Make sure the RGB LED is off */
 	led_set(0, 0, 0);
 
-	/* Clear any remaining data in RAM */
+	/* Clear any remaining data in RAM, the whole frame being sent once the screen is ready */
 	gfx_clear();
-	gfx_print_screen();
-
-	please_wait_screen();
 
 	fs_ll_init();
 	fs_ll_mount();
@@ -1279,37 +2110,65 @@ int main(void)
 	}
 
 	/* Try to load the default ROM from the filesystem if it is not loaded */
-	if (!rom_is_loaded() && rom_load(DEFAULT_ROM_SLOT) < 0) {
-		job_schedule(&autooff_job, &autooff_job_fn, time_get() + MS_TO_MCU_TIME(AUTOOFF_PERIOD));
+	if (!rom_is_loaded()) {
+		/* Importing it blocks for a while, so the screen must be up to show it */
+#if defined(BOARD_HAS_SSD1306)
+		ssd1306_wait_ready();
+#elif defined(BOARD_HAS_UC1701X)
+		uc1701x_wait_ready();
+#endif
+		please_wait_screen();
 
-		rom_loaded = 0;
-	} else {
-		/* TamaLIB must use an integer time base of at least 32768 Hz,
-		 * so shift the one provided by the MCU until it fits.
-		 */
-		while (((MCU_TIME_FREQ_X1000 << time_shift) < TAMALIB_FREQ * 1000) || (MCU_TIME_FREQ_X1000 << time_shift) % 1000) {
-			time_shift++;
+		if (rom_load(DEFAULT_ROM_SLOT) < 0) {
+			rom_loaded = 0;
 		}
+	}
 
-		if (tamalib_init((const u12_t *) g_program, NULL, (MCU_TIME_FREQ_X1000 << time_shift)/1000)) {
+	if (!rom_loaded) {
+		job_schedule(&autooff_job, &autooff_job_fn, time_get() + MS_TO_MCU_TIME(AUTOOFF_PERIOD));
+	} else {
+		if (emu_init(g_program, &hal_update_screen)) {
 			system_fatal_error();
 		}
 
+		emu_set_speed(speed_levels[speed_level].ratio, speed_levels[speed_level].cpu_share);
+
 		if (config.autosave_enabled) {
 			/* Try to load the autosave slot and schedule the next autosave */
 			state_load(AUTOSAVE_SLOT);
 			job_schedule(&autosave_job, &autosave_job_fn, time_get() + MS_TO_MCU_TIME(AUTOSAVE_PERIOD));
+
+			if (suspend_info.magic == SUSPEND_MAGIC && state_stat(AUTOSAVE_SLOT)) {
+				/* The device has been powered off, emulate the time spent since the state was saved */
+				catchup_start(suspend_info.elapsed);
+			}
+		}
+
+		if (catchup_remaining > 0) {
+			job_schedule(&catchup_job, &catchup_job_fn, JOB_ASAP);
+		} else {
+			emu_start();
 		}
 
-		job_schedule(&cpu_job, &cpu_job_fn, JOB_ASAP);
+		job_schedule(&idle_job, &idle_job_fn, time_get() + MS_TO_MCU_TIME(IDLE_SUSPEND_PERIOD));
+
+#ifdef PROFILER
+		job_schedule(&prof_job, &prof_job_fn, time_get() + MS_TO_MCU_TIME(PROF_PERIOD));
+#endif
 	}
 
+	suspend_info.magic = 0;
+
 	states_init();
 
 	input_register_handler(&input_handler);
 
 	battery_register_cb(&battery_cb);
 
+#ifdef JOB_STATS
+	stats_menu_init();
+#endif
+
 	menu_register(main_menu);
 
 	job_schedule(&render_job, &render_job_fn, JOB_ASAP);
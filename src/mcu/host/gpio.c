@@ -0,0 +1,52 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+
+#include "board.h"
+#include "screen_ll.h"
+#include "mcu_types.h"
+#include "gpio.h"
+
+static uint16_t ports[HOST_GPIO_PORT_NUM] = {0};
+
+
+void gpio_set(gpio_port_t port, gpio_pin_t pin)
+{
+	if (port == BOARD_SCREEN_NSS_PORT && pin == BOARD_SCREEN_NSS_PIN && !(ports[port] & pin)) {
+		/* End of an SPI transaction */
+		screen_ll_release();
+	}
+
+	ports[port] |= pin;
+}
+
+void gpio_clear(gpio_port_t port, gpio_pin_t pin)
+{
+	if (port == BOARD_SCREEN_RST_PORT && pin == BOARD_SCREEN_RST_PIN) {
+		screen_ll_reset();
+	}
+
+	ports[port] &= ~pin;
+}
+
+uint8_t gpio_get(gpio_port_t port, gpio_pin_t pin)
+{
+	return ((ports[port] & pin) != 0);
+}
@@ -0,0 +1,223 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "job.h"
+#include "time.h"
+#include "input_ll.h"
+#include "input.h"
+
+#define INPUT_NUM					5
+
+#define LONG_PRESS_DURATION				1000 //ms
+
+#define MAX_EVENTS					1024
+
+/* The input script is a list of "<time in ms> <input> <0|1>" lines,
+ * sorted by time, the inputs being named after input_names[].
+ */
+typedef struct {
+	mcu_time_t time;
+	input_t input;
+	input_state_t state;
+} input_event_t;
+
+typedef struct {
+	input_state_t state;
+	input_state_t hw_state;
+	job_t edge_job;
+	job_t long_press_job;
+	uint8_t long_press_enabled;
+	uint8_t edge_pending;
+} input_data_t;
+
+static const char *input_names[INPUT_NUM] = {"left", "middle", "right", "charging", "vbus"};
+
+static input_data_t inputs[INPUT_NUM];
+
+static input_event_t events[MAX_EVENTS];
+static uint32_t events_num = 0;
+static uint32_t next_event = 0;
+
+static void (*input_handler)(input_t, input_state_t, uint8_t) = NULL;
+
+
+static void load_script(const char *path)
+{
+	FILE *f;
+	char line[128];
+	char name[32];
+	unsigned long ms;
+	unsigned int state;
+	uint32_t i;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open input script %s !\n", path);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL && events_num < MAX_EVENTS) {
+		if (line[0] == '#' || sscanf(line, "%lu %31s %u", &ms, name, &state) != 3) {
+			/* Comment or empty line */
+			continue;
+		}
+
+		for (i = 0; i < INPUT_NUM; i++) {
+			if (!strcmp(name, input_names[i])) {
+				break;
+			}
+		}
+
+		if (i == INPUT_NUM) {
+			fprintf(stderr, "Unknown input %s !\n", name);
+			continue;
+		}
+
+		events[events_num].time = MS_TO_MCU_TIME(ms);
+		events[events_num].input = (input_t) i;
+		events[events_num].state = state ? INPUT_STATE_HIGH : INPUT_STATE_LOW;
+		events_num++;
+	}
+
+	fclose(f);
+}
+
+void input_init(void)
+{
+	char *path = getenv("MCUGOTCHI_INPUT");
+	uint8_t i;
+
+	/* Buttons are active high, the charging input is active low */
+	for (i = 0; i < INPUT_NUM; i++) {
+		inputs[i].state = (i == INPUT_BATTERY_CHARGING) ? INPUT_STATE_HIGH : INPUT_STATE_LOW;
+		inputs[i].hw_state = inputs[i].state;
+		inputs[i].long_press_enabled = (i <= INPUT_BTN_RIGHT);
+	}
+
+	job_set_name(&(inputs[INPUT_BTN_LEFT].edge_job), "in.L");
+	job_set_name(&(inputs[INPUT_BTN_LEFT].long_press_job), "lp.L");
+	job_set_name(&(inputs[INPUT_BTN_MIDDLE].edge_job), "in.M");
+	job_set_name(&(inputs[INPUT_BTN_MIDDLE].long_press_job), "lp.M");
+	job_set_name(&(inputs[INPUT_BTN_RIGHT].edge_job), "in.R");
+	job_set_name(&(inputs[INPUT_BTN_RIGHT].long_press_job), "lp.R");
+	job_set_name(&(inputs[INPUT_BATTERY_CHARGING].edge_job), "in.CH");
+	job_set_name(&(inputs[INPUT_VBUS_SENSING].edge_job), "in.VB");
+
+	if (path != NULL) {
+		load_script(path);
+	}
+}
+
+input_state_t input_get_state(input_t input)
+{
+	return inputs[input].state;
+}
+
+void input_register_handler(void (*handler)(input_t, input_state_t, uint8_t))
+{
+	input_handler = handler;
+}
+
+static void long_press_job_fn(job_t *job)
+{
+	input_t input;
+
+	for (input = 0; input < INPUT_NUM; input++) {
+		if (job == &(inputs[input].long_press_job)) {
+			break;
+		}
+	}
+
+	if (input < INPUT_NUM && input_handler != NULL) {
+		input_handler(input, inputs[input].state, 1);
+	}
+}
+
+static void edge_job_fn(job_t *job)
+{
+	input_t input;
+
+	for (input = 0; input < INPUT_NUM; input++) {
+		if (job == &(inputs[input].edge_job)) {
+			break;
+		}
+	}
+
+	if (input == INPUT_NUM) {
+		return;
+	}
+
+	inputs[input].edge_pending = 0;
+
+	if (inputs[input].state == inputs[input].hw_state) {
+		return;
+	}
+
+	/* The scripted inputs do not bounce, so there is no need to debounce them */
+	inputs[input].state = inputs[input].hw_state;
+
+	if (inputs[input].long_press_enabled) {
+		if (inputs[input].state == INPUT_STATE_HIGH) {
+			job_schedule(&(inputs[input].long_press_job), &long_press_job_fn, time_get() + MS_TO_MCU_TIME(LONG_PRESS_DURATION));
+		} else {
+			job_cancel(&(inputs[input].long_press_job));
+		}
+	}
+
+	if (input_handler != NULL) {
+		input_handler(input, inputs[input].state, 0);
+	}
+}
+
+uint8_t input_ll_get_next_event(mcu_time_t *time)
+{
+	if (next_event >= events_num) {
+		return 0;
+	}
+
+	*time = events[next_event].time;
+
+	return 1;
+}
+
+void input_ll_process(mcu_time_t time)
+{
+	input_event_t *e;
+
+	/* Same as an EXTI IRQ for each event that occurred */
+	while (next_event < events_num && (int32_t) (time - events[next_event].time) >= 0) {
+		e = &events[next_event];
+
+		if (inputs[e->input].edge_pending) {
+			/* Let the previous edge be handled first, so that no press is lost */
+			break;
+		}
+
+		inputs[e->input].hw_state = e->state;
+		inputs[e->input].edge_pending = 1;
+		job_schedule(&(inputs[e->input].edge_job), &edge_job_fn, JOB_ASAP);
+
+		next_event++;
+	}
+}
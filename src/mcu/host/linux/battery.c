@@ -0,0 +1,67 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "job.h"
+#include "battery.h"
+
+#define BATTERY_DEFAULT_VOLTAGE				4000 // mV
+
+static void (*battery_cb)(uint16_t) = NULL;
+
+static job_t battery_processing_job;
+
+static uint16_t battery_v = BATTERY_DEFAULT_VOLTAGE;
+
+
+void battery_init(void)
+{
+	char *str = getenv("MCUGOTCHI_BATTERY");
+
+	if (str != NULL) {
+		battery_v = strtoul(str, NULL, 0);
+	}
+
+	job_set_name(&battery_processing_job, "adc");
+}
+
+void battery_register_cb(void (*cb)(uint16_t))
+{
+	battery_cb = cb;
+}
+
+static void battery_processing_job_fn(job_t *job)
+{
+	if (battery_cb != NULL) {
+		battery_cb(battery_v);
+	}
+}
+
+void battery_start_meas(void)
+{
+	/* The measurement is immediately available */
+	job_schedule(&battery_processing_job, &battery_processing_job_fn, JOB_ASAP);
+}
+
+void battery_stop_meas(void)
+{
+	job_cancel(&battery_processing_job);
+}
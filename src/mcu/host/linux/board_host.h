@@ -0,0 +1,39 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _BOARD_DEF_H_
+#define _BOARD_DEF_H_
+
+/* Virtual board running the firmware on a Linux host */
+
+#define BOARD_HAS_SSD1306
+
+#define HOST_GPIO_PORT_SCREEN			0
+#define HOST_GPIO_PORT_NUM			1
+
+#define BOARD_SCREEN_DC_PIN			(1 << 0)
+#define BOARD_SCREEN_DC_PORT			HOST_GPIO_PORT_SCREEN
+
+#define BOARD_SCREEN_NSS_PIN			(1 << 1)
+#define BOARD_SCREEN_NSS_PORT			HOST_GPIO_PORT_SCREEN
+
+#define BOARD_SCREEN_RST_PIN			(1 << 2)
+#define BOARD_SCREEN_RST_PORT			HOST_GPIO_PORT_SCREEN
+
+#endif /* _BOARD_DEF_H_ */
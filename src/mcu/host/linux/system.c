@@ -0,0 +1,174 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "time_ll.h"
+#include "input_ll.h"
+#include "system_ll.h"
+#include "screen_ll.h"
+#include "spi_ll.h"
+#include "storage_ll.h"
+#include "system.h"
+#include "time.h"
+
+static uint8_t state_lock_counters[STATE_NUM] = {0};
+
+static uint8_t irq_running = 0;
+
+/* Virtual time after which the firmware stops, 0 to run forever */
+static mcu_time_t duration = 0;
+
+static uint32_t wakeups = 0;
+static mcu_time_t residency[STATE_NUM] = {0};
+
+
+static void check_duration(void)
+{
+	if (duration != 0 && (int32_t) (time_get() - duration) >= 0) {
+		system_ll_exit(0);
+	}
+}
+
+static void process_irqs(void)
+{
+	/* Do not preempt a running IRQ handler */
+	if (irq_running) {
+		return;
+	}
+
+	irq_running = 1;
+
+	input_ll_process(time_get());
+	spi_ll_process(time_get());
+	check_duration();
+
+	irq_running = 0;
+}
+
+void system_disable_irq(void)
+{
+}
+
+void system_enable_irq(void)
+{
+	/* Pending IRQs are handled as soon as they are unmasked */
+	process_irqs();
+}
+
+void system_init(void)
+{
+	char *str = getenv("MCUGOTCHI_DURATION");
+
+	if (str != NULL) {
+		duration = MS_TO_MCU_TIME(strtoul(str, NULL, 0));
+	}
+}
+
+void system_enter_state(exec_state_t state)
+{
+	mcu_time_t start = time_get();
+	mcu_time_t wakeup = time_ll_get_wakeup();
+	mcu_time_t t;
+
+	/* The next input event is an IRQ that might wake the CPU up earlier */
+	if (input_ll_get_next_event(&t) && (int32_t) (t - wakeup) < 0) {
+		wakeup = t;
+	}
+
+	/* As well as the end of an SPI transfer */
+	if (spi_ll_get_next_event(&t) && (int32_t) (t - wakeup) < 0) {
+		wakeup = t;
+	}
+
+	/* As well as the end of the run */
+	if (duration != 0 && (int32_t) (duration - wakeup) < 0) {
+		wakeup = duration;
+	}
+
+	time_ll_sleep_until(wakeup);
+
+	wakeups++;
+	residency[state] += time_get() - start;
+}
+
+exec_state_t system_get_max_state(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < HIGHEST_ALLOWED_STATE; i++) {
+		if (state_lock_counters[i]) {
+			return (exec_state_t) i;
+		}
+	}
+
+	return HIGHEST_ALLOWED_STATE;
+}
+
+void system_lock_max_state(exec_state_t state, uint8_t *lock)
+{
+	if (!(*lock)) {
+		state_lock_counters[(uint32_t) state]++;
+		*lock = 1;
+	}
+}
+
+void system_unlock_max_state(exec_state_t state, uint8_t *lock)
+{
+	if (*lock) {
+		state_lock_counters[(uint32_t) state]--;
+		*lock = 0;
+	}
+}
+
+void system_reset(void)
+{
+	fprintf(stderr, "Reset requested\n");
+	system_ll_exit(0);
+}
+
+void system_dfu_reset(void)
+{
+	fprintf(stderr, "DFU reset requested\n");
+	system_ll_exit(0);
+}
+
+void system_fatal_error(void)
+{
+	fprintf(stderr, "Fatal error !\n");
+	system_ll_exit(1);
+}
+
+void system_ll_exit(int status)
+{
+	mcu_time_t t = time_get();
+	uint32_t i;
+
+	/* Summary of the run */
+	fprintf(stderr, "time %llu ms, wakeups %u", (unsigned long long) MCU_TIME_TO_US((uint64_t) t)/1000, wakeups);
+	for (i = STATE_SLEEP_S1; i < STATE_NUM; i++) {
+		fprintf(stderr, ", S%u %llu ms", i, (unsigned long long) MCU_TIME_TO_US((uint64_t) residency[i])/1000);
+	}
+	fprintf(stderr, ", SPI %u bytes in %u frames, first frame at %llu ms, OLED load %.2f\n", screen_ll_get_bytes(), screen_ll_get_frames(), (unsigned long long) MCU_TIME_TO_US((uint64_t) screen_ll_get_first_frame_time())/1000, screen_ll_get_load());
+	fprintf(stderr, "flash %u erases, %u words programmed, busy %llu ms\n", storage_ll_get_erases(), storage_ll_get_programs(), (unsigned long long) MCU_TIME_TO_US((uint64_t) storage_ll_get_busy_time())/1000);
+
+	exit(status);
+}
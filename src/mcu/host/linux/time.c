@@ -0,0 +1,142 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "system.h"
+#include "time_ll.h"
+#include "time.h"
+
+#define NS_TO_MCU_TIME(t)				(((t) * MCU_TIME_FREQ_NUM)/(MCU_TIME_FREQ_DEN * 1000ULL))
+#define MCU_TIME_TO_NS(t)				(((t) * MCU_TIME_FREQ_DEN * 1000ULL)/MCU_TIME_FREQ_NUM)
+
+/* The virtual clock follows the real one multiplied by the speed factor,
+ * plus all the sleep periods that have been skipped. A speed factor of 0
+ * means that the clock runs at real time speed while the CPU is running,
+ * and that all the sleep periods are skipped.
+ */
+static uint64_t start_ns = 0;
+static uint64_t skipped_ticks = 0;
+static uint32_t speed = 1;
+
+static mcu_time_t wakeup_time;
+static uint8_t wakeup_enabled = 0;
+
+
+static uint64_t get_real_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void time_init(void)
+{
+	char *str = getenv("MCUGOTCHI_SPEED");
+
+	if (str != NULL) {
+		speed = strtoul(str, NULL, 0);
+	}
+
+	start_ns = get_real_ns();
+}
+
+mcu_time_t time_get(void)
+{
+	uint64_t elapsed = get_real_ns() - start_ns;
+
+	if (speed > 1) {
+		elapsed *= speed;
+	}
+
+	return (mcu_time_t) (NS_TO_MCU_TIME(elapsed) + skipped_ticks);
+}
+
+void time_wait_until(mcu_time_t time)
+{
+	/* There is no point in busy waiting on the host */
+	time_ll_sleep_until(time);
+}
+
+void time_delay(mcu_time_t time)
+{
+	time_wait_until(time_get() + time);
+}
+
+exec_state_t time_configure_wakeup(mcu_time_t time)
+{
+	mcu_time_t t = time_get();
+	int32_t delta = time - t;
+	exec_state_t max_state = system_get_max_state();
+	exec_state_t state;
+
+	if (delta < SLEEP_S1_THRESHOLD || max_state == STATE_RUN) {
+		/* Job is now/very soon, no time to sleep */
+		wakeup_enabled = 0;
+		return STATE_RUN;
+	} else if (delta < SLEEP_S2_THRESHOLD || max_state == STATE_SLEEP_S1) {
+		state = STATE_SLEEP_S1;
+	} else if (delta < SLEEP_S3_THRESHOLD || max_state == STATE_SLEEP_S2) {
+		state = STATE_SLEEP_S2;
+	} else {
+		state = STATE_SLEEP_S3;
+	}
+
+	wakeup_time = time;
+	wakeup_enabled = 1;
+
+	return state;
+}
+
+mcu_time_t time_ll_get_wakeup(void)
+{
+	if (wakeup_enabled) {
+		return wakeup_time;
+	}
+
+	/* Like on the STM32L0, the timer overflow wakes the CPU up anyway */
+	return (time_get() | 0xFFFF) + 1;
+}
+
+void time_ll_sleep_until(mcu_time_t time)
+{
+	int32_t delta = time - time_get();
+	struct timespec ts;
+	uint64_t ns;
+
+	if (delta <= 0) {
+		return;
+	}
+
+	if (speed == 0) {
+		/* Fast-forward */
+		skipped_ticks += delta;
+		return;
+	}
+
+	ns = MCU_TIME_TO_NS((uint64_t) delta)/speed;
+	ts.tv_sec = ns/1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+
+	nanosleep(&ts, NULL);
+}
@@ -0,0 +1,318 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "time.h"
+#include "ssd1306.h"
+#include "screen_ll.h"
+
+/* Emulation of the SSD1306 controller behind the SPI bus, what it displays
+ * being dumped as a PBM image at the end of each SPI transaction that
+ * changed it. The segment current, which is proportional to the contrast
+ * and to the lit pixels of the row being driven, is integrated over time
+ * as a load in lit segments at full contrast.
+ */
+
+#define SCREEN_WIDTH					128
+#define SCREEN_PAGES					8
+#define SCREEN_HEIGHT					(SCREEN_PAGES * 8)
+
+static uint8_t gddram[SCREEN_PAGES][SCREEN_WIDTH];
+
+static uint8_t cmd[3];
+static uint8_t cmd_len = 0;
+
+static uint8_t addr_mode;
+static uint8_t col, col_start, col_end;
+static uint8_t page, page_start, page_end;
+
+static uint8_t display_on;
+static uint8_t inverted;
+static uint8_t mux_ratio, disp_offset, start_line;
+static uint8_t contrast;
+
+static double load = 0; // Current one
+static double load_total = 0; // Integrated over time
+static double load_elapsed = 0;
+static mcu_time_t load_time = 0;
+
+static uint8_t dirty = 0;
+static uint32_t frames = 0;
+static uint32_t bytes = 0; // Sent over SPI, commands included
+static mcu_time_t first_frame_time = 0; // 0 until something is displayed
+
+
+static uint8_t cmd_args_num(uint8_t c)
+{
+	switch (c) {
+		case REG_COL_ADDR:
+		case REG_PAGE_ADDR:
+			return 2;
+
+		case REG_CONTRAST:
+		case REG_MEM_ADDR_MODE:
+		case REG_MUX_RATIO:
+		case REG_DISP_OFFSET:
+		case REG_COM_PINS_CFG:
+		case REG_DISP_CLK_CFG:
+		case REG_PRE_CHRG_PERIOD:
+		case REG_CHRG_PUMP:
+		case REG_VCOMH_LVL:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+static void process_cmd(void)
+{
+	uint8_t c = cmd[0];
+
+	if (c < REG_HIGH_ADDR) {
+		col = (col & 0xF0) | (c & 0x0F);
+	} else if (c < REG_MEM_ADDR_MODE) {
+		col = (col & 0x0F) | ((c & 0x07) << 4);
+	} else if ((c & 0xF8) == REG_PAGE_START_ADDR) {
+		page = c & 0x07;
+	} else if ((c & 0xC0) == REG_DISP_START_LINE) {
+		start_line = c & 0x3F;
+		dirty = 1;
+	} else {
+		switch (c) {
+			case REG_MEM_ADDR_MODE:
+				addr_mode = cmd[1] & 0x3;
+				break;
+
+			case REG_COL_ADDR:
+				col_start = col = cmd[1] & 0x7F;
+				col_end = cmd[2] & 0x7F;
+				break;
+
+			case REG_PAGE_ADDR:
+				page_start = page = cmd[1] & 0x07;
+				page_end = cmd[2] & 0x07;
+				break;
+
+			case REG_CONTRAST:
+				contrast = cmd[1];
+				break;
+
+			case REG_MUX_RATIO:
+				mux_ratio = cmd[1] & 0x3F;
+				dirty = 1;
+				break;
+
+			case REG_DISP_OFFSET:
+				disp_offset = cmd[1] & 0x3F;
+				dirty = 1;
+				break;
+
+			case REG_DISP_MODE:
+			case REG_DISP_MODE | 1:
+				inverted = c & 0x1;
+				dirty = 1;
+				break;
+
+			case REG_DISP_EN:
+			case REG_DISP_EN | 1:
+				display_on = c & 0x1;
+				dirty = 1;
+				break;
+		}
+	}
+}
+
+static void write_data(uint8_t data)
+{
+	gddram[page][col] = data;
+	dirty = 1;
+
+	switch (addr_mode) {
+		case MEM_ADDR_MODE_H:
+			if (col++ >= col_end) {
+				col = col_start;
+				page = (page >= page_end) ? page_start : page + 1;
+			}
+			break;
+
+		case MEM_ADDR_MODE_V:
+			if (page++ >= page_end) {
+				page = page_start;
+				col = (col >= col_end) ? col_start : col + 1;
+			}
+			break;
+
+		default:
+			/* Page addressing mode */
+			col = (col + 1) & (SCREEN_WIDTH - 1);
+			break;
+	}
+}
+
+static uint8_t pixel_on(uint8_t x, uint8_t y)
+{
+	/* COM y shows the row (y + offset) % 64 if it is driven */
+	uint8_t row = (y + disp_offset) & (SCREEN_HEIGHT - 1);
+
+	if (!display_on || row > mux_ratio) {
+		return 0;
+	}
+
+	row = (row + start_line) & (SCREEN_HEIGHT - 1);
+
+	return ((gddram[row >> 3][x] >> (row & 0x7)) & 0x1) ^ inverted;
+}
+
+static void update_load(void)
+{
+	mcu_time_t t = time_get();
+	uint32_t lit = 0;
+	uint8_t x, y;
+
+	load_total += load * (mcu_time_t) (t - load_time);
+	load_elapsed += (mcu_time_t) (t - load_time);
+	load_time = t;
+
+	for (y = 0; y < SCREEN_HEIGHT; y++) {
+		for (x = 0; x < SCREEN_WIDTH; x++) {
+			lit += pixel_on(x, y);
+		}
+	}
+
+	/* One driven row at a time */
+	load = ((double) lit * (contrast + 1))/(256.0 * (mux_ratio + 1));
+}
+
+static void dump_pbm(void)
+{
+	char *pattern = getenv("MCUGOTCHI_SCREEN");
+	char path[256];
+	uint8_t row[SCREEN_WIDTH/8];
+	uint8_t x, y;
+	FILE *f;
+
+	if (pattern == NULL) {
+		return;
+	}
+
+	/* A pattern containing a %u gets one file per frame */
+	snprintf(path, sizeof(path), pattern, frames);
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		return;
+	}
+
+	fprintf(f, "P4\n%u %u\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+
+	for (y = 0; y < SCREEN_HEIGHT; y++) {
+		memset(row, 0, sizeof(row));
+
+		for (x = 0; x < SCREEN_WIDTH; x++) {
+			/* A lit pixel is a black one */
+			if (pixel_on(x, y)) {
+				row[x >> 3] |= 0x80 >> (x & 0x7);
+			}
+		}
+
+		fwrite(row, 1, sizeof(row), f);
+	}
+
+	fclose(f);
+}
+
+void screen_ll_reset(void)
+{
+	cmd_len = 0;
+
+	addr_mode = MEM_ADDR_MODE_P;
+	col = col_start = 0;
+	col_end = SCREEN_WIDTH - 1;
+	page = page_start = 0;
+	page_end = SCREEN_PAGES - 1;
+
+	display_on = 0;
+	inverted = 0;
+	mux_ratio = SCREEN_HEIGHT - 1;
+	disp_offset = 0;
+	start_line = 0;
+	contrast = 0x7F;
+}
+
+void screen_ll_write(uint8_t data, uint8_t is_data)
+{
+	bytes++;
+
+	if (is_data) {
+		write_data(data);
+		return;
+	}
+
+	cmd[cmd_len++] = data;
+
+	if (cmd_len > cmd_args_num(cmd[0])) {
+		process_cmd();
+		cmd_len = 0;
+	}
+}
+
+void screen_ll_release(void)
+{
+	/* A command cannot span several transactions */
+	cmd_len = 0;
+
+	update_load();
+
+	if (dirty) {
+		if (display_on && first_frame_time == 0) {
+			first_frame_time = time_get();
+		}
+
+		dump_pbm();
+		frames++;
+		dirty = 0;
+	}
+}
+
+uint32_t screen_ll_get_bytes(void)
+{
+	return bytes;
+}
+
+uint32_t screen_ll_get_frames(void)
+{
+	return frames;
+}
+
+mcu_time_t screen_ll_get_first_frame_time(void)
+{
+	return first_frame_time;
+}
+
+double screen_ll_get_load(void)
+{
+	update_load();
+
+	return (load_elapsed > 0) ? load_total/load_elapsed : 0;
+}
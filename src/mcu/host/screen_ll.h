@@ -0,0 +1,37 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _SCREEN_LL_H_
+#define _SCREEN_LL_H_
+
+#include <stdint.h>
+
+#include "time.h"
+
+
+void screen_ll_reset(void);
+void screen_ll_write(uint8_t data, uint8_t is_data);
+void screen_ll_release(void);
+
+uint32_t screen_ll_get_bytes(void);
+uint32_t screen_ll_get_frames(void);
+mcu_time_t screen_ll_get_first_frame_time(void);
+double screen_ll_get_load(void); // Mean number of lit segments at full contrast
+
+#endif /* _SCREEN_LL_H_ */
@@ -0,0 +1,125 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "board.h"
+#include "gpio.h"
+#include "system.h"
+#include "time.h"
+#include "screen_ll.h"
+#include "system_ll.h"
+#include "time_ll.h"
+#include "spi_ll.h"
+#include "spi.h"
+
+/* Stand-in for the TX DMA: a transfer lasts as long as it would on a real
+ * SPI bus, the bytes reaching the screen and the callback being called as
+ * an IRQ at its end. The buffer is checked to be left untouched meanwhile.
+ */
+
+#define SPI_FREQ					4000000 // Hz
+#define SPI_DMA_MAX_LENGTH				1024
+
+static uint8_t *dma_data;
+static uint16_t dma_length;
+static uint8_t dma_copy[SPI_DMA_MAX_LENGTH];
+static void (*dma_cb)(void) = NULL;
+static mcu_time_t dma_end;
+static uint8_t dma_ongoing = 0;
+
+static uint8_t state_lock = 0;
+
+
+void spi_init(void)
+{
+}
+
+void spi_write(uint8_t data)
+{
+	screen_ll_write(data, gpio_get(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN));
+}
+
+void spi_write_dma(uint8_t *data, uint16_t length, void (*cb)(void))
+{
+	uint64_t ticks = ((uint64_t) length * 8 * MCU_TIME_FREQ_NUM * 1000000ULL)/(MCU_TIME_FREQ_DEN * SPI_FREQ);
+
+	spi_wait();
+
+	if (length > SPI_DMA_MAX_LENGTH) {
+		fprintf(stderr, "SPI DMA transfer of %u bytes is too long\n", length);
+		system_ll_exit(1);
+	}
+
+	memcpy(dma_copy, data, length);
+	dma_data = data;
+	dma_length = length;
+	dma_cb = cb;
+	dma_end = time_get() + ((ticks > 0) ? ticks : 1);
+	dma_ongoing = 1;
+
+	system_lock_max_state(STATE_SLEEP_S1, &state_lock);
+}
+
+void spi_wait(void)
+{
+	while (dma_ongoing) {
+		time_ll_sleep_until(dma_end);
+		spi_ll_process(time_get());
+	}
+}
+
+uint8_t spi_ll_get_next_event(mcu_time_t *time)
+{
+	if (!dma_ongoing) {
+		return 0;
+	}
+
+	*time = dma_end;
+	return 1;
+}
+
+void spi_ll_process(mcu_time_t time)
+{
+	uint16_t i;
+
+	if (!dma_ongoing || (int32_t) (time - dma_end) < 0) {
+		return;
+	}
+
+	/* The real DMA reads the buffer while sending it */
+	if (memcmp(dma_copy, dma_data, dma_length)) {
+		fprintf(stderr, "SPI DMA buffer modified during the transfer\n");
+		system_ll_exit(1);
+	}
+
+	for (i = 0; i < dma_length; i++) {
+		spi_write(dma_data[i]);
+	}
+
+	system_unlock_max_state(STATE_SLEEP_S1, &state_lock);
+
+	dma_ongoing = 0;
+
+	if (dma_cb != NULL) {
+		dma_cb();
+	}
+}
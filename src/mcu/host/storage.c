@@ -0,0 +1,324 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "system.h"
+#include "time_ll.h"
+#include "job.h"
+#include "storage_ll.h"
+#include "storage.h"
+
+#define STORAGE_DEFAULT_FILE				"flash.bin"
+
+/* Like on the STM32L0, erasing a page or programming a word stalls the CPU */
+#define FLASH_ERASE_TIME				3200 // us
+#define FLASH_PROGRAM_TIME				3200 // us
+
+/* Time without any write after which the cached page is written back */
+#define CACHE_FLUSH_DELAY				500 // ms
+
+/* The flash is emulated in RAM, and every modification is written
+ * through to the image file so that it survives the run.
+ */
+uint32_t host_storage[STORAGE_SIZE >> 2];
+
+static int fd = -1;
+
+static uint32_t erases = 0;
+static uint32_t programs = 0;
+static mcu_time_t busy_time = 0;
+
+/* Same page cache as on the MCU */
+static uint32_t cache[STORAGE_PAGE_SIZE];
+static uint32_t cache_offset;
+static uint8_t cache_dirty = 0;
+
+static job_t cache_job;
+
+
+static int8_t flush(uint32_t offset, uint32_t length)
+{
+	if (fd < 0) {
+		/* No backing file */
+		return 0;
+	}
+
+	if (pwrite(fd, &host_storage[offset], length << 2, offset << 2) != (ssize_t) (length << 2)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void flash_busy(uint32_t us)
+{
+	mcu_time_t t = US_TO_MCU_TIME((uint64_t) us);
+
+	busy_time += t;
+	time_ll_sleep_until(time_get() + t);
+}
+
+/* The host flash is addressed in words from its start, since its address
+ * does not fit in 32 bits
+ */
+static int8_t flash_write(uint32_t offset, uint32_t *data, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		if (host_storage[offset + i] != STORAGE_ERASED_WORD) {
+			fprintf(stderr, "Programming a word that is not erased !\n");
+			system_fatal_error();
+		}
+
+		host_storage[offset + i] = data[i];
+		programs++;
+		flash_busy(FLASH_PROGRAM_TIME);
+	}
+
+	return flush(offset, length);
+}
+
+static int8_t flash_erase_page(uint32_t offset)
+{
+	uint32_t i;
+
+	for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+		host_storage[offset + i] = STORAGE_ERASED_WORD;
+	}
+
+	erases++;
+	flash_busy(FLASH_ERASE_TIME);
+
+	return flush(offset, STORAGE_PAGE_SIZE);
+}
+
+static int8_t write_page(uint32_t page_offset, uint32_t *page)
+{
+	uint32_t *ptr = &host_storage[page_offset];
+	uint32_t i;
+
+	/* A word can only be programmed if it is erased, thus the page is
+	 * erased only if a word that is already programmed must change
+	 */
+	for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+		if (ptr[i] != page[i] && ptr[i] != STORAGE_ERASED_WORD) {
+			if (flash_erase_page(page_offset) < 0) {
+				return -1;
+			}
+
+			break;
+		}
+	}
+
+	/* Only program the words that differ */
+	for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+		if (ptr[i] != page[i] && flash_write(page_offset + i, &page[i], 1) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void cache_job_fn(job_t *job)
+{
+	storage_sync();
+}
+
+void storage_ll_init(void)
+{
+	char *path = getenv("MCUGOTCHI_FLASH");
+	ssize_t len;
+	uint32_t i;
+
+	if (path == NULL) {
+		path = STORAGE_DEFAULT_FILE;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open flash image %s !\n", path);
+		system_fatal_error();
+	}
+
+	len = pread(fd, host_storage, STORAGE_SIZE, 0);
+	if (len < 0) {
+		len = 0;
+	}
+
+	/* A new or truncated image is completed with erased pages */
+	if (len < STORAGE_SIZE) {
+		for (i = len >> 2; i < (STORAGE_SIZE >> 2); i++) {
+			host_storage[i] = STORAGE_ERASED_WORD;
+		}
+
+		flush(0, STORAGE_SIZE >> 2);
+	}
+}
+
+uint32_t storage_ll_get_erases(void)
+{
+	return erases;
+}
+
+uint32_t storage_ll_get_programs(void)
+{
+	return programs;
+}
+
+mcu_time_t storage_ll_get_busy_time(void)
+{
+	return busy_time;
+}
+
+int8_t storage_read(uint32_t offset, uint32_t *data, uint32_t length)
+{
+	uint32_t i;
+
+	if (length == 0) {
+		/* Nothing to do */
+		return 0;
+	}
+
+	if ((offset + length) * sizeof(uint32_t) > STORAGE_SIZE) {
+		return -1;
+	}
+
+	memcpy(data, &host_storage[offset], length << 2);
+
+	/* The cached page is more recent than the flash */
+	if (cache_dirty && offset < cache_offset + STORAGE_PAGE_SIZE && offset + length > cache_offset) {
+		for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+			if (cache_offset + i >= offset && cache_offset + i < offset + length) {
+				data[cache_offset + i - offset] = cache[i];
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int8_t write_within_page(uint32_t offset, uint32_t *data, uint32_t length)
+{
+	uint32_t page_offset = offset & ~(STORAGE_PAGE_SIZE - 1);
+	uint32_t offset_in_page = offset & (STORAGE_PAGE_SIZE - 1);
+	uint32_t i = 0;
+
+	if (length > STORAGE_PAGE_SIZE - offset_in_page) {
+		return -1;
+	}
+
+	if (!cache_dirty || cache_offset != page_offset) {
+		/* Write the previously cached page back */
+		if (storage_sync() < 0) {
+			return -1;
+		}
+
+		/* Read the page if needed */
+		if (offset_in_page != 0 ||  length < STORAGE_PAGE_SIZE) {
+			memcpy(cache, &host_storage[page_offset], STORAGE_PAGE_SIZE << 2);
+		}
+
+		cache_offset = page_offset;
+		cache_dirty = 1;
+	}
+
+	/* Update the page */
+	for (i = 0; i < length; i++) {
+		cache[offset_in_page + i] = data[i];
+	}
+
+	return 0;
+}
+
+int8_t storage_write(uint32_t offset, uint32_t *data, uint32_t length)
+{
+	uint32_t page_len;
+
+	if ((offset + length) * sizeof(uint32_t) > STORAGE_SIZE) {
+		return -1;
+	}
+
+	while (length > 0) {
+		/* Either a first partial page or a full page */
+		page_len = STORAGE_PAGE_SIZE - (offset & (STORAGE_PAGE_SIZE - 1));
+
+		if (page_len > length) {
+			/* Partial page */
+			page_len = length;
+		}
+
+		if (write_within_page(offset, data, page_len) < 0) {
+			return -1;
+		}
+
+		offset += page_len;
+		data += page_len;
+		length -= page_len;
+	}
+
+	if (cache_dirty) {
+		/* Write the page back if nothing else comes */
+		job_schedule(&cache_job, &cache_job_fn, time_get() + MS_TO_MCU_TIME(CACHE_FLUSH_DELAY));
+	}
+
+	return 0;
+}
+
+int8_t storage_sync(void)
+{
+	job_cancel(&cache_job);
+
+	if (!cache_dirty) {
+		return 0;
+	}
+
+	if (write_page(cache_offset, cache) < 0) {
+		return -1;
+	}
+
+	/* storage_read() uses the cache until the flash holds the whole page */
+	cache_dirty = 0;
+
+	return 0;
+}
+
+int8_t storage_erase(void)
+{
+	uint32_t i;
+
+	/* The cached page would be erased anyway */
+	job_cancel(&cache_job);
+	cache_dirty = 0;
+
+	for (i = 0; i < (STORAGE_SIZE >> 2); i += STORAGE_PAGE_SIZE) {
+		if (flash_erase_page(i) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _STORAGE_LL_H_
+#define _STORAGE_LL_H_
+
+#include <stdint.h>
+
+#include "time.h"
+
+
+void storage_ll_init(void);
+
+uint32_t storage_ll_get_erases(void);
+uint32_t storage_ll_get_programs(void); // Number of programmed words
+mcu_time_t storage_ll_get_busy_time(void);
+
+#endif /* _STORAGE_LL_H_ */
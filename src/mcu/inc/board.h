@@ -25,6 +25,8 @@
 #include "board_discovery_stm32f0.h"
 #elif defined(BOARD_IS_opentama)
 #include "board_opentama.h"
+#elif defined(BOARD_IS_host)
+#include "board_host.h"
 #else
 #error "No board selected"
 #endif
@@ -26,4 +26,11 @@
 void spi_init(void);
 void spi_write(uint8_t data);
 
+/* Sends length bytes in the background, cb being called from IRQ context
+ * once the last one has been shifted out. The data must not be modified
+ * until then.
+ */
+void spi_write_dma(uint8_t *data, uint16_t length, void (*cb)(void));
+void spi_wait(void);
+
 #endif /* _SPI_H_ */
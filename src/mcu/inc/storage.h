@@ -27,6 +27,7 @@
 
 int8_t storage_read(uint32_t offset, uint32_t *data, uint32_t length);
 int8_t storage_write(uint32_t offset, uint32_t *data, uint32_t length);
+int8_t storage_sync(void);
 int8_t storage_erase(void);
 
 #endif /* _STORAGE_H_ */
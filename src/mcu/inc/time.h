@@ -27,6 +27,7 @@
 
 #define US_TO_MCU_TIME(t)				((t * MCU_TIME_FREQ_NUM + MCU_TIME_FREQ_DEN - 1)/MCU_TIME_FREQ_DEN)
 #define MS_TO_MCU_TIME(t)				(US_TO_MCU_TIME(t * 1000ULL))
+#define MCU_TIME_TO_US(t)				((t * MCU_TIME_FREQ_DEN)/MCU_TIME_FREQ_NUM)
 
 #define MCU_TIME_FREQ_X1000 				((1000000000ULL/MCU_TIME_FREQ_DEN) * MCU_TIME_FREQ_NUM)
 
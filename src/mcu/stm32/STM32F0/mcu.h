@@ -29,6 +29,7 @@
 
 #define STORAGE_SIZE						0x13000
 #define STORAGE_PAGE_SIZE					512 // 2KB in words (sizeof(uint32_t))
+#define STORAGE_ERASED_WORD					0xFFFFFFFF
 
 #define STORAGE_ROM_OFFSET					0x0
 #define STORAGE_ROM_SIZE					0xC00 // 12KB in words (sizeof(uint32_t))
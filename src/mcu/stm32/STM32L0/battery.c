@@ -49,6 +49,7 @@ static uint8_t state_lock = 0;
 
 void battery_init(void)
 {
+	job_set_name(&battery_processing_job, "adc");
 }
 
 #ifdef BOARD_VBATT_ANA_ADC_CHANNEL
@@ -122,9 +123,8 @@ static void adc_deinit(void)
 	HAL_ADC_DeInit(&AdcHandle);
 	__HAL_RCC_ADC1_CLK_DISABLE();
 
-	/* Disable DMA */
+	/* Disable DMA, keeping its clock enabled since the screen SPI uses it as well */
 	HAL_DMA_DeInit(&DmaHandle);
-	__HAL_RCC_DMA1_CLK_DISABLE();
 }
 #endif
 
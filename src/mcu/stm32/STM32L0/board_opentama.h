@@ -26,6 +26,10 @@
 
 #define BOARD_SCREEN_SPI			SPI1
 #define BOARD_SCREEN_SPI_CLK_ENABLE		__HAL_RCC_SPI1_CLK_ENABLE
+#define BOARD_SCREEN_SPI_DMA_CHANNEL		DMA1_Channel3
+#define BOARD_SCREEN_SPI_DMA_REQUEST		DMA_REQUEST_1
+#define BOARD_SCREEN_SPI_DMA_IRQn		DMA1_Channel2_3_IRQn
+#define BOARD_SCREEN_SPI_DMA_IRQHandler		DMA1_Channel2_3_IRQHandler
 
 #define BOARD_SCREEN_SCLK_PIN			GPIO_PIN_5
 #define BOARD_SCREEN_SCLK_PORT			GPIOA
@@ -74,7 +74,7 @@ static DRESULT storage_drv_ioctl(BYTE lun, BYTE cmd, void *buff)
 	switch (cmd) {
 		/* Make sure that no pending write process */
 		case CTRL_SYNC :
-			res = RES_OK;
+			res = (storage_sync() < 0) ? RES_ERROR : RES_OK;
 			break;
 
 		/* Get number of sectors on the disk (DWORD) */
@@ -138,6 +138,9 @@ int8_t fs_ll_mount(void)
 
 int8_t fs_ll_umount(void)
 {
+	/* Leave nothing behind in the storage cache */
+	storage_sync();
+
 	if (f_mount(0, (TCHAR const*) storage_drv_path, 0) != FR_OK) {
 		return -1;
 	}
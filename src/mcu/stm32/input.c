@@ -32,6 +32,10 @@
 #define DEBOUNCE_DURATION				100 //ms
 #define LONG_PRESS_DURATION				1000 //ms
 
+/* How early the jobs are allowed to run to share a wakeup */
+#define DEBOUNCE_SLACK					20 //ms
+#define LONG_PRESS_SLACK				50 //ms
+
 typedef struct {
 	input_state_t state;
 	job_t debounce_job;
@@ -73,6 +77,10 @@ void input_init(void)
 	inputs[INPUT_BTN_LEFT].pin = BOARD_LEFT_BTN_PIN;
 	inputs[INPUT_BTN_LEFT].state = get_input_hw_state(INPUT_BTN_LEFT);
 	inputs[INPUT_BTN_LEFT].long_press_enabled = 1;
+	job_set_name(&(inputs[INPUT_BTN_LEFT].debounce_job), "dbc.L");
+	job_set_slack(&(inputs[INPUT_BTN_LEFT].debounce_job), MS_TO_MCU_TIME(DEBOUNCE_SLACK));
+	job_set_name(&(inputs[INPUT_BTN_LEFT].long_press_job), "lp.L");
+	job_set_slack(&(inputs[INPUT_BTN_LEFT].long_press_job), MS_TO_MCU_TIME(LONG_PRESS_SLACK));
 	config_int_line(&(inputs[INPUT_BTN_LEFT].handle), inputs[INPUT_BTN_LEFT].exti_port, (inputs[INPUT_BTN_LEFT].state == INPUT_STATE_HIGH) ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_RISING);
 
 	/* Middle button */
@@ -82,6 +90,10 @@ void input_init(void)
 	inputs[INPUT_BTN_MIDDLE].pin = BOARD_MIDDLE_BTN_PIN;
 	inputs[INPUT_BTN_MIDDLE].state = get_input_hw_state(INPUT_BTN_MIDDLE);
 	inputs[INPUT_BTN_MIDDLE].long_press_enabled = 1;
+	job_set_name(&(inputs[INPUT_BTN_MIDDLE].debounce_job), "dbc.M");
+	job_set_slack(&(inputs[INPUT_BTN_MIDDLE].debounce_job), MS_TO_MCU_TIME(DEBOUNCE_SLACK));
+	job_set_name(&(inputs[INPUT_BTN_MIDDLE].long_press_job), "lp.M");
+	job_set_slack(&(inputs[INPUT_BTN_MIDDLE].long_press_job), MS_TO_MCU_TIME(LONG_PRESS_SLACK));
 	config_int_line(&(inputs[INPUT_BTN_MIDDLE].handle), inputs[INPUT_BTN_MIDDLE].exti_port, (inputs[INPUT_BTN_MIDDLE].state == INPUT_STATE_HIGH) ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_RISING);
 
 	/* Right button */
@@ -91,6 +103,10 @@ void input_init(void)
 	inputs[INPUT_BTN_RIGHT].pin = BOARD_RIGHT_BTN_PIN;
 	inputs[INPUT_BTN_RIGHT].state = get_input_hw_state(INPUT_BTN_RIGHT);
 	inputs[INPUT_BTN_RIGHT].long_press_enabled = 1;
+	job_set_name(&(inputs[INPUT_BTN_RIGHT].debounce_job), "dbc.R");
+	job_set_slack(&(inputs[INPUT_BTN_RIGHT].debounce_job), MS_TO_MCU_TIME(DEBOUNCE_SLACK));
+	job_set_name(&(inputs[INPUT_BTN_RIGHT].long_press_job), "lp.R");
+	job_set_slack(&(inputs[INPUT_BTN_RIGHT].long_press_job), MS_TO_MCU_TIME(LONG_PRESS_SLACK));
 	config_int_line(&(inputs[INPUT_BTN_RIGHT].handle), inputs[INPUT_BTN_RIGHT].exti_port, (inputs[INPUT_BTN_RIGHT].state == INPUT_STATE_HIGH) ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_RISING);
 
 #ifdef BOARD_NCHARGE_PIN
@@ -101,6 +117,8 @@ void input_init(void)
 	inputs[INPUT_BATTERY_CHARGING].pin = BOARD_NCHARGE_PIN;
 	inputs[INPUT_BATTERY_CHARGING].state = get_input_hw_state(INPUT_BATTERY_CHARGING);
 	inputs[INPUT_BATTERY_CHARGING].long_press_enabled = 0;
+	job_set_name(&(inputs[INPUT_BATTERY_CHARGING].debounce_job), "dbc.CH");
+	job_set_slack(&(inputs[INPUT_BATTERY_CHARGING].debounce_job), MS_TO_MCU_TIME(DEBOUNCE_SLACK));
 	config_int_line(&(inputs[INPUT_BATTERY_CHARGING].handle), inputs[INPUT_BATTERY_CHARGING].exti_port, (inputs[INPUT_BATTERY_CHARGING].state == INPUT_STATE_HIGH) ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_RISING);
 #endif
 
@@ -112,6 +130,8 @@ void input_init(void)
 	inputs[INPUT_VBUS_SENSING].pin = BOARD_VBUS_SENSE_PIN;
 	inputs[INPUT_VBUS_SENSING].state = get_input_hw_state(INPUT_VBUS_SENSING);
 	inputs[INPUT_VBUS_SENSING].long_press_enabled = 0;
+	job_set_name(&(inputs[INPUT_VBUS_SENSING].debounce_job), "dbc.VB");
+	job_set_slack(&(inputs[INPUT_VBUS_SENSING].debounce_job), MS_TO_MCU_TIME(DEBOUNCE_SLACK));
 	config_int_line(&(inputs[INPUT_VBUS_SENSING].handle), inputs[INPUT_VBUS_SENSING].exti_port, (inputs[INPUT_VBUS_SENSING].state == INPUT_STATE_HIGH) ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_RISING);
 #endif
 }
@@ -35,6 +35,7 @@
 #define BREATHING_HOLD_TIME				1 // s
 #define BREATHING_OUT_TIME				2 // s
 #define BREATHING_WAIT_TIME				5 // s
+#define BREATHING_SLACK					10 // ms
 
 #define TIMER_PERIOD					0x400
 
@@ -53,6 +54,11 @@ static uint8_t state_lock = 0;
 
 void led_init(void)
 {
+#ifdef BREATHING_LED
+	job_set_name(&breathing_job, "led");
+	job_set_slack(&breathing_job, MS_TO_MCU_TIME(BREATHING_SLACK));
+#endif
+
 #ifdef BOARD_LED_RGB_PWM_TIMER
 	/* Enable TIM clock */
 	BOARD_LED_RGB_CLK_ENABLE();
@@ -140,7 +146,7 @@ static void breathing_job_fn(job_t *job)
 {
 	uint8_t r, g, b;
 
-	job_schedule(&breathing_job, &breathing_job_fn, time_get() + MS_TO_MCU_TIME(1000)/BREATHING_RATE);
+	job_schedule_next(&breathing_job, MS_TO_MCU_TIME(1000)/BREATHING_RATE);
 
 	if (breathing_counter < BREATHING_IN_TIME * BREATHING_RATE) {
 		r = (red * breathing_counter)/(BREATHING_IN_TIME * BREATHING_RATE);
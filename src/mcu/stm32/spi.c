@@ -22,9 +22,16 @@
 #include "stm32_hal.h"
 
 #include "spi.h"
+#include "system.h"
 #include "board.h"
 
 static SPI_HandleTypeDef hspi;
+static DMA_HandleTypeDef hdma;
+
+static void (*dma_cb)(void) = NULL;
+static volatile uint8_t dma_ongoing = 0;
+
+static uint8_t state_lock = 0;
 
 
 void spi_init(void)
@@ -49,6 +56,25 @@ void spi_init(void)
 	SPI_1LINE_TX(&hspi);
 
 	__HAL_SPI_ENABLE(&hspi);
+
+	/* TX DMA, the transfers being started directly on the channel */
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	hdma.Instance                 = BOARD_SCREEN_SPI_DMA_CHANNEL;
+	hdma.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+	hdma.Init.PeriphInc           = DMA_PINC_DISABLE;
+	hdma.Init.MemInc              = DMA_MINC_ENABLE;
+	hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+	hdma.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+	hdma.Init.Mode                = DMA_NORMAL;
+	hdma.Init.Priority            = DMA_PRIORITY_LOW;
+#ifdef BOARD_SCREEN_SPI_DMA_REQUEST
+	hdma.Init.Request             = BOARD_SCREEN_SPI_DMA_REQUEST;
+#endif
+	HAL_DMA_Init(&hdma);
+
+	HAL_NVIC_SetPriority(BOARD_SCREEN_SPI_DMA_IRQn, 2, 0);
+	HAL_NVIC_EnableIRQ(BOARD_SCREEN_SPI_DMA_IRQn);
 }
 
 void spi_write(uint8_t data)
@@ -57,3 +83,47 @@ void spi_write(uint8_t data)
 	*(__IO uint8_t *) (&(hspi.Instance)->DR) = data;
 	while(__HAL_SPI_GET_FLAG(&hspi, SPI_FLAG_BSY));
 }
+
+static void spi_dma_complete(DMA_HandleTypeDef *h)
+{
+	void (*cb)(void) = dma_cb;
+
+	/* The last byte is still being shifted out */
+	while(__HAL_SPI_GET_FLAG(&hspi, SPI_FLAG_BSY));
+
+	CLEAR_BIT(hspi.Instance->CR2, SPI_CR2_TXDMAEN);
+
+	/* The SPI does not work in low-power modes */
+	system_unlock_max_state(STATE_SLEEP_S1, &state_lock);
+
+	dma_ongoing = 0;
+
+	if (cb != NULL) {
+		cb();
+	}
+}
+
+void spi_write_dma(uint8_t *data, uint16_t length, void (*cb)(void))
+{
+	spi_wait();
+
+	dma_cb = cb;
+	dma_ongoing = 1;
+
+	system_lock_max_state(STATE_SLEEP_S1, &state_lock);
+
+	hdma.XferCpltCallback = &spi_dma_complete;
+	HAL_DMA_Start_IT(&hdma, (uint32_t) data, (uint32_t) &(hspi.Instance)->DR, length);
+
+	SET_BIT(hspi.Instance->CR2, SPI_CR2_TXDMAEN);
+}
+
+void spi_wait(void)
+{
+	while (dma_ongoing);
+}
+
+void BOARD_SCREEN_SPI_DMA_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdma);
+}
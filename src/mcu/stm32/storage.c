@@ -21,8 +21,47 @@
 
 #include "stm32_hal.h"
 
+#include "job.h"
 #include "storage.h"
 
+/* Time without any write after which the cached page is written back */
+#define CACHE_FLUSH_DELAY				500 // ms
+
+/* The last written page is kept in RAM until another page is written,
+ * storage_sync() is called or no write happened for CACHE_FLUSH_DELAY,
+ * so that consecutive writes within the same page only cost one
+ * erase/program cycle.
+ */
+static uint32_t cache[STORAGE_PAGE_SIZE];
+static uint32_t cache_addr;
+static uint8_t cache_dirty = 0;
+
+static job_t cache_job;
+
+
+/* The USB mass storage uses the cache from its interrupt, thus only that
+ * interrupt is masked while the cache or the flash is in use, and the others
+ * (SysTick, SPI DMA) keep running during an erase/program cycle.
+ * The USB interrupt cannot preempt itself, so locking from it is harmless.
+ */
+static uint8_t cache_lock(void)
+{
+	uint8_t usb_irq = (NVIC->ISER[0] & (1UL << ((uint32_t) USB_IRQn & 0x1FUL))) != 0;
+
+	NVIC_DisableIRQ(USB_IRQn);
+	__DSB();
+	__ISB();
+
+	return usb_irq;
+}
+
+static void cache_unlock(uint8_t usb_irq)
+{
+	/* Do not enable the interrupt if the USB is not started */
+	if (usb_irq) {
+		NVIC_EnableIRQ(USB_IRQn);
+	}
+}
 
 static void flash_read(uint32_t addr, uint32_t *data, uint32_t length)
 {
@@ -61,8 +100,65 @@ static int16_t flash_erase_page(uint32_t addr)
 	return (HAL_FLASHEx_Erase(&erase_init, &error) == HAL_OK ? 0 : -1);
 }
 
+static int8_t write_page(uint32_t page_addr, uint32_t *page)
+{
+	__IO uint32_t *ptr = (__IO uint32_t *) page_addr;
+	uint32_t i;
+
+	/* A word can only be programmed if it is erased, thus the page is
+	 * erased only if a word that is already programmed must change
+	 */
+	for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+		if (ptr[i] != page[i] && ptr[i] != STORAGE_ERASED_WORD) {
+			if (flash_erase_page(page_addr) < 0) {
+				return -1;
+			}
+
+			break;
+		}
+	}
+
+	/* Only program the words that differ */
+	for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+		if (ptr[i] != page[i] && flash_write(page_addr + (i << 2), &page[i], 1) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int8_t cache_flush(void)
+{
+	int8_t ret;
+
+	if (!cache_dirty) {
+		return 0;
+	}
+
+	HAL_FLASH_Unlock();
+	ret = write_page(cache_addr, cache);
+	HAL_FLASH_Lock();
+
+	/* storage_read() uses the cache until the flash holds the whole page */
+	if (ret == 0) {
+		cache_dirty = 0;
+	}
+
+	return ret;
+}
+
+static void cache_job_fn(job_t *job)
+{
+	storage_sync();
+}
+
 int8_t storage_read(uint32_t offset, uint32_t *data, uint32_t length)
 {
+	uint32_t addr = STORAGE_BASE_ADDRESS + (offset << 2);
+	uint32_t i;
+	uint8_t usb_irq;
+
 	if (length == 0) {
 		/* Nothing to do */
 		return 0;
@@ -72,14 +168,26 @@ int8_t storage_read(uint32_t offset, uint32_t *data, uint32_t length)
 		return -1;
 	}
 
-	flash_read(STORAGE_BASE_ADDRESS + (offset << 2), data, length);
+	usb_irq = cache_lock();
+
+	flash_read(addr, data, length);
+
+	/* The cached page is more recent than the flash */
+	if (cache_dirty && addr < cache_addr + (STORAGE_PAGE_SIZE << 2) && addr + (length << 2) > cache_addr) {
+		for (i = 0; i < STORAGE_PAGE_SIZE; i++) {
+			if (cache_addr + (i << 2) >= addr && cache_addr + (i << 2) < addr + (length << 2)) {
+				data[(cache_addr + (i << 2) - addr) >> 2] = cache[i];
+			}
+		}
+	}
+
+	cache_unlock(usb_irq);
 
 	return 0;
 }
 
 static int8_t write_within_page(uint32_t addr, uint32_t *data, uint32_t length)
 {
-	uint32_t page[STORAGE_PAGE_SIZE];
 	uint32_t page_addr = addr & ~((STORAGE_PAGE_SIZE << 2) - 1);
 	uint32_t offset_in_page = (addr >> 2) & (STORAGE_PAGE_SIZE - 1);
 	uint32_t i = 0;
@@ -88,24 +196,24 @@ static int8_t write_within_page(uint32_t addr, uint32_t *data, uint32_t length)
 		return -1;
 	}
 
-	/* Read the page if needed */
-	if (offset_in_page != 0 ||  length < STORAGE_PAGE_SIZE) {
-		flash_read(page_addr, page, STORAGE_PAGE_SIZE);
-	}
+	if (!cache_dirty || cache_addr != page_addr) {
+		/* Write the previously cached page back */
+		if (cache_flush() < 0) {
+			return -1;
+		}
 
-	/* Update the page */
-	for (i = 0; i < length; i++) {
-		page[offset_in_page + i] = data[i];
-	}
+		/* Read the page if needed */
+		if (offset_in_page != 0 ||  length < STORAGE_PAGE_SIZE) {
+			flash_read(page_addr, cache, STORAGE_PAGE_SIZE);
+		}
 
-	/* Erase the page */
-	if (flash_erase_page(page_addr) < 0) {
-		return -1;
+		cache_addr = page_addr;
+		cache_dirty = 1;
 	}
 
-	/* Write the page back */
-	if (flash_write(page_addr, page, STORAGE_PAGE_SIZE) < 0) {
-		return -1;
+	/* Update the page */
+	for (i = 0; i < length; i++) {
+		cache[offset_in_page + i] = data[i];
 	}
 
 	return 0;
@@ -115,8 +223,10 @@ int8_t storage_write(uint32_t offset, uint32_t *data, uint32_t length)
 {
 	uint32_t page_len;
 	uint32_t addr = STORAGE_BASE_ADDRESS + (offset << 2);
+	uint8_t usb_irq;
+	uint8_t dirty;
 
-	HAL_FLASH_Unlock();
+	usb_irq = cache_lock();
 
 	while (length > 0) {
 		/* Either a first partial page or a full page */
@@ -128,7 +238,7 @@ int8_t storage_write(uint32_t offset, uint32_t *data, uint32_t length)
 		}
 
 		if (write_within_page(addr, data, page_len) < 0) {
-			HAL_FLASH_Lock();
+			cache_unlock(usb_irq);
 			return -1;
 		}
 
@@ -137,25 +247,55 @@ int8_t storage_write(uint32_t offset, uint32_t *data, uint32_t length)
 		length -= page_len;
 	}
 
-	HAL_FLASH_Lock();
+	dirty = cache_dirty;
+	cache_unlock(usb_irq);
+
+	if (dirty) {
+		/* Write the page back if nothing else comes */
+		job_schedule(&cache_job, &cache_job_fn, time_get() + MS_TO_MCU_TIME(CACHE_FLUSH_DELAY));
+	}
 
 	return 0;
 }
 
+int8_t storage_sync(void)
+{
+	int8_t ret;
+	uint8_t usb_irq;
+
+	job_cancel(&cache_job);
+
+	usb_irq = cache_lock();
+	ret = cache_flush();
+	cache_unlock(usb_irq);
+
+	return ret;
+}
+
 int8_t storage_erase(void)
 {
 	uint32_t i;
+	uint8_t usb_irq;
+
+	job_cancel(&cache_job);
+
+	usb_irq = cache_lock();
+
+	/* The cached page would be erased anyway */
+	cache_dirty = 0;
 
 	HAL_FLASH_Unlock();
 
 	for (i = 0; i < (STORAGE_SIZE >> 2)/STORAGE_PAGE_SIZE; i++) {
 		if (flash_erase_page(STORAGE_BASE_ADDRESS + i * (STORAGE_PAGE_SIZE << 2)) < 0) {
 			HAL_FLASH_Lock();
+			cache_unlock(usb_irq);
 			return -1;
 		}
 	}
 
 	HAL_FLASH_Lock();
+	cache_unlock(usb_irq);
 
 	return 0;
 }
@@ -19,6 +19,7 @@
  */
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "gfx.h"
 #include "menu.h"
@@ -33,6 +34,8 @@
 
 #define MAX_DEPTH				9
 
+#define ARG_MAX_LEN				21 // Characters fitting on a row
+
 static uint8_t is_visible = 0;
 static menu_item_t *g_menu = NULL;
 static menu_item_t *current_menu = NULL;
@@ -41,6 +44,18 @@ static uint8_t current_depth = 0;
 
 static menu_parent_t parents[MAX_DEPTH + 1] = { 0 }; // parents[0] will always be NULL
 
+/* The visible items being contiguous, item % ITEMS_ON_SCREEN gives each of
+ * them its own slot
+ */
+static char arg_cache[ITEMS_ON_SCREEN][ARG_MAX_LEN + 1];
+static int8_t arg_item[ITEMS_ON_SCREEN]; // Item cached in each slot, -1 if none
+static uint8_t args_stale = 0;
+
+/* What the screen currently shows */
+static uint8_t screen_valid = 0;
+static int8_t row_item[ITEMS_ON_SCREEN]; // -1 if the row is empty
+static uint8_t row_selected[ITEMS_ON_SCREEN];
+
 
 static void menu_confirm_yes(uint8_t pos, menu_parent_t *parent)
 {
@@ -62,11 +77,47 @@ static menu_item_t confirm_menu[] = {
 	{NULL, NULL, NULL, 0, NULL},
 };
 
-void menu_draw(void)
+/* Returns 1 if the cached string changed */
+static uint8_t arg_fetch(uint8_t item)
 {
-	uint8_t i;
+	uint8_t slot = item % ITEMS_ON_SCREEN;
+	char *str = current_menu[item].arg_cb(item, &parents[current_depth]);
+
+	if (arg_item[slot] == (int8_t) item && !strncmp(arg_cache[slot], str, ARG_MAX_LEN)) {
+		return 0;
+	}
+
+	strncpy(arg_cache[slot], str, ARG_MAX_LEN);
+	arg_cache[slot][ARG_MAX_LEN] = '\0';
+	arg_item[slot] = item;
+
+	return 1;
+}
+
+static void draw_row(uint8_t row, int8_t item)
+{
+	uint8_t y = MENU_OFFSET_Y + row * MENU_ITEM_STRIDE_Y, x;
+	color_t color = (item == current_item) ? COLOR_OFF_WHITE : COLOR_ON_BLACK;
+
+	gfx_square(0, y, DISPLAY_WIDTH, MENU_ITEM_STRIDE_Y, (item == current_item) ? COLOR_ON_BLACK : COLOR_OFF_WHITE);
+
+	if (item < 0) {
+		return;
+	}
+
+	x = gfx_string(current_menu[item].name, MENU_OFFSET_X + TEXT_OFFSET_X, y + TEXT_OFFSET_Y, MENU_ITEM_SIZE, color, BACKGROUND_OFF);
+
+	if (current_menu[item].arg_cb != NULL) {
+		gfx_string(arg_cache[item % ITEMS_ON_SCREEN], x, y + TEXT_OFFSET_Y, MENU_ITEM_SIZE, color, BACKGROUND_OFF);
+	}
+}
+
+/* Redraws only the rows whose item, selection or argument changed */
+static void menu_update(void)
+{
+	uint8_t i, changed;
 	uint8_t top_item = 0;
-	uint8_t y = MENU_OFFSET_Y, x;
+	int8_t item = 0;
 
 	if (!is_visible) {
 		return;
@@ -76,27 +127,65 @@ void menu_draw(void)
 		top_item = current_item - ITEMS_ON_SCREEN + 1;
 	}
 
-	gfx_clear();
-
-	gfx_square(0, y + (current_item - top_item) * MENU_ITEM_STRIDE_Y, DISPLAY_WIDTH, MENU_ITEM_STRIDE_Y, COLOR_ON_BLACK);
+	if (!screen_valid) {
+		gfx_clear();
+	}
 
 	for (i = 0; i < ITEMS_ON_SCREEN; i++) {
-		if (current_menu[top_item + i].name == NULL) {
-			break;
+		/* The rows past the end of the menu are empty */
+		if (item >= 0 && current_menu[top_item + i].name != NULL) {
+			item = top_item + i;
+		} else {
+			item = -1;
 		}
 
-		x = gfx_string(current_menu[top_item + i].name, MENU_OFFSET_X + TEXT_OFFSET_X, y + TEXT_OFFSET_Y, MENU_ITEM_SIZE, (top_item + i == current_item) ? COLOR_OFF_WHITE : COLOR_ON_BLACK, BACKGROUND_OFF);
+		changed = !screen_valid || row_item[i] != item || row_selected[i] != (item == current_item);
 
-		if (current_menu[top_item + i].arg_cb != NULL) {
-			gfx_string(current_menu[top_item + i].arg_cb(top_item + i, &parents[current_depth]), x, y + TEXT_OFFSET_Y, MENU_ITEM_SIZE, (top_item + i == current_item) ? COLOR_OFF_WHITE : COLOR_ON_BLACK, BACKGROUND_OFF);
+		if (item >= 0 && current_menu[item].arg_cb != NULL && (args_stale || arg_item[item % ITEMS_ON_SCREEN] != item)) {
+			changed |= arg_fetch(item);
 		}
 
-		y += MENU_ITEM_STRIDE_Y;
+		if (changed) {
+			draw_row(i, item);
+			row_item[i] = item;
+			row_selected[i] = (item == current_item);
+		}
 	}
 
+	screen_valid = 1;
+	args_stale = 0;
+
 	gfx_print_screen();
 }
 
+static void select_next(void)
+{
+	do {
+		current_item++;
+
+		if (current_menu[current_item].name == NULL) {
+			current_item = 0;
+		}
+	} while(current_menu[current_item].cb == NULL && current_menu[current_item].sub_menu == NULL);
+}
+
+void menu_invalidate(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < ITEMS_ON_SCREEN; i++) {
+		arg_item[i] = -1;
+	}
+
+	screen_valid = 0;
+}
+
+void menu_draw(void)
+{
+	menu_invalidate();
+	menu_update();
+}
+
 void menu_register(menu_item_t *menu)
 {
 	g_menu = menu;
@@ -113,7 +202,7 @@ void menu_open(void)
 	current_menu = g_menu;
 	current_depth = 0;
 	current_item = -1;
-	menu_next();
+	select_next();
 
 	menu_draw();
 }
@@ -133,15 +222,9 @@ uint8_t menu_is_visible(void)
 
 void menu_next(void)
 {
-	do {
-		current_item++;
-
-		if (current_menu[current_item].name == NULL) {
-			current_item = 0;
-		}
-	} while(current_menu[current_item].cb == NULL && current_menu[current_item].sub_menu == NULL);
+	select_next();
 
-	menu_draw();
+	menu_update();
 }
 
 void menu_enter(void)
@@ -156,6 +239,9 @@ void menu_enter(void)
 		} else {
 			/* Execute the callback right away */
 			current_menu[current_item].cb(current_item, &parents[current_depth]);
+
+			/* It may have changed any of the arguments */
+			args_stale = 1;
 		}
 	} else if (current_menu[current_item].sub_menu != NULL) {
 		/* Sub menu */
@@ -168,10 +254,12 @@ void menu_enter(void)
 		parents[current_depth].pos = current_item;
 		current_menu = sub_menu;
 		current_item = -1;
-		menu_next();
-	}
+		select_next();
 
-	menu_draw();
+		menu_draw();
+	} else {
+		menu_update();
+	}
 }
 
 void menu_back(void)
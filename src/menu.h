@@ -39,6 +39,7 @@ struct menu_parent {
 };
 
 void menu_draw(void);
+void menu_invalidate(void);
 
 void menu_register(menu_item_t *items);
 
@@ -0,0 +1,162 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ff_gen_drv.h"
+
+#include "prof.h"
+
+#ifdef PROFILER
+
+#define PROF_CHUNK_SIZE				32 // bytes, must hold the header and divide the buckets
+
+static uint16_t buckets[PROF_BUCKET_NUM];
+static uint32_t samples;
+static uint32_t halt_samples;
+static uint32_t int_samples;
+
+
+static void halve_all(void)
+{
+	uint16_t i;
+
+	for (i = 0; i < PROF_BUCKET_NUM; i++) {
+		buckets[i] >>= 1;
+	}
+
+	samples >>= 1;
+	halt_samples >>= 1;
+	int_samples >>= 1;
+}
+
+void prof_sample(uint16_t pc, prof_sample_t type)
+{
+	uint16_t *b = &buckets[(pc % PROF_ROM_SIZE) >> PROF_BUCKET_SHIFT];
+
+	if (type != PROF_SAMPLE_HALT && *b == UINT16_MAX) {
+		/* Keep the proportions instead of saturating */
+		halve_all();
+	}
+
+	samples++;
+
+	switch (type) {
+		case PROF_SAMPLE_HALT:
+			halt_samples++;
+			return;
+
+		case PROF_SAMPLE_INT:
+			int_samples++;
+			break;
+
+		case PROF_SAMPLE_RUN:
+			break;
+	}
+
+	(*b)++;
+}
+
+void prof_reset(void)
+{
+	uint16_t i;
+
+	for (i = 0; i < PROF_BUCKET_NUM; i++) {
+		buckets[i] = 0;
+	}
+
+	samples = 0;
+	halt_samples = 0;
+	int_samples = 0;
+}
+
+static uint8_t * put_u16(uint8_t *ptr, uint16_t v)
+{
+	ptr[0] = v & 0xFF;
+	ptr[1] = (v >> 8) & 0xFF;
+
+	return ptr + 2;
+}
+
+static uint8_t * put_u32(uint8_t *ptr, uint32_t v)
+{
+	ptr = put_u16(ptr, v & 0xFFFF);
+
+	return put_u16(ptr, (v >> 16) & 0xFFFF);
+}
+
+int8_t prof_dump(void)
+{
+	FIL f;
+	UINT num;
+	uint8_t buf[PROF_CHUNK_SIZE];
+	uint8_t *ptr = buf;
+	uint16_t i, j;
+
+	if (f_open(&f, PROF_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE)) {
+		/* Error */
+		return -1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		*(ptr++) = PROF_MAGIC[i];
+	}
+
+	*(ptr++) = PROF_VERSION;
+	*(ptr++) = PROF_BUCKET_SHIFT;
+	ptr = put_u16(ptr, PROF_BUCKET_NUM);
+	ptr = put_u32(ptr, PROF_PERIOD);
+	ptr = put_u32(ptr, samples);
+	ptr = put_u32(ptr, halt_samples);
+	ptr = put_u32(ptr, int_samples);
+
+	if (f_write(&f, buf, PROF_HEADER_SIZE, &num) || (num < PROF_HEADER_SIZE)) {
+		/* Error */
+		f_close(&f);
+		return -1;
+	}
+
+	/* Then the buckets, by chunks */
+	for (i = 0; i < PROF_BUCKET_NUM; i += PROF_CHUNK_SIZE/2) {
+		ptr = buf;
+		for (j = i; j < i + PROF_CHUNK_SIZE/2; j++) {
+			ptr = put_u16(ptr, buckets[j]);
+		}
+
+		if (f_write(&f, buf, PROF_CHUNK_SIZE, &num) || (num < PROF_CHUNK_SIZE)) {
+			/* Error */
+			f_close(&f);
+			return -1;
+		}
+	}
+
+	f_close(&f);
+
+	return 0;
+}
+
+#else
+
+int8_t prof_dump(void)
+{
+	return -1;
+}
+
+#endif
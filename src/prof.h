@@ -0,0 +1,65 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+
+/* Define this to enable the sampling profiler of the emulated ROM */
+//#define PROFILER
+
+#define PROF_FILE_NAME				"prof.bin"
+#define PROF_PERIOD				3 //ms
+
+/* The PC is sampled by buckets of 16 instructions */
+#define PROF_BUCKET_SHIFT			4
+#define PROF_ROM_SIZE				4096 // instructions
+#define PROF_BUCKET_NUM				(PROF_ROM_SIZE >> PROF_BUCKET_SHIFT)
+
+/* prof.bin layout, all values being little-endian:
+ * - "PROF" magic (4 bytes)
+ * - version (1 byte)
+ * - bucket shift (1 byte)
+ * - bucket number (2 bytes)
+ * - sampling period in ms (4 bytes)
+ * - samples (4 bytes)
+ * - samples taken while the CPU was halted (4 bytes)
+ * - samples taken in an interrupt handler (4 bytes)
+ * - one 2-bytes counter per bucket, halted samples excluded
+ */
+#define PROF_MAGIC				"PROF"
+#define PROF_VERSION				1
+#define PROF_HEADER_SIZE			24
+
+typedef enum {
+	PROF_SAMPLE_RUN = 0,
+	PROF_SAMPLE_HALT,
+	PROF_SAMPLE_INT,
+} prof_sample_t;
+
+
+#ifdef PROFILER
+void prof_sample(uint16_t pc, prof_sample_t type);
+void prof_reset(void);
+#endif
+
+int8_t prof_dump(void);
+
+#endif /* _PROF_H_ */
@@ -88,6 +88,11 @@ int8_t rom_load(uint8_t slot)
 
 	f_close(&f);
 
+	/* The ROM is run from the flash */
+	if (storage_sync() < 0) {
+		return -1;
+	}
+
 	return 0;
 }
 
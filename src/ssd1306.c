@@ -18,17 +18,130 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "time.h"
 #include "spi.h"
 #include "gpio.h"
 #include "board.h"
+#include "job.h"
 #include "ssd1306.h"
 
-void ssd1306_init(void)
+#define POWER_UP_MS					10
+
+static void (*window_cb)(void) = NULL;
+
+static job_t init_job;
+static mcu_time_t ready_time;
+static void (*ready_cb)(void) = NULL;
+static uint8_t ready = 0;
+
+/* Applied once the screen is ready */
+static disp_mode_t disp_mode = DISP_MODE_NORMAL;
+static pwr_mode_t pwr_mode = PWR_MODE_ON;
+static uint8_t contrast = SSD1306_CONTRAST_DEFAULT;
+static uint8_t rows_first = 0;
+static uint8_t rows_count = SSD1306_ROWS;
+
+static const uint8_t init_cmds[] = {
+	REG_SEG_REMAP | 0,
+	REG_COM_PINS_CFG, 0x12,
+	REG_COM_SCAN_DIR | 0,
+
+	REG_MEM_ADDR_MODE, MEM_ADDR_MODE_H,
+	REG_COL_ADDR, 0x00, 0x7F,
+	REG_PAGE_ADDR, 0x00, 0x07,
+
+	REG_VCOMH_LVL, 0x00,
+
+	REG_DISP_ON | 0,
+	REG_DISP_CLK_CFG, 0x80,
+};
+
+
+static uint8_t rows_cmds(uint8_t *cmds)
+{
+	/* COM i shows the driven row (i + offset) % 64, if any, each of them
+	 * showing the GDDRAM row start line + n. This keeps every row in place.
+	 */
+	cmds[0] = REG_MUX_RATIO;
+	cmds[1] = rows_count - 1;
+	cmds[2] = REG_DISP_OFFSET;
+	cmds[3] = (SSD1306_ROWS - rows_first) % SSD1306_ROWS;
+	cmds[4] = REG_DISP_START_LINE | rows_first;
+
+	return 5;
+}
+
+static uint8_t contrast_cmds(uint8_t *cmds)
+{
+	/* Each row being driven 1/rows_count of the time, the segment current
+	 * follows the number of rows to keep the same brightness
+	 */
+	cmds[0] = REG_CONTRAST;
+	cmds[1] = ((uint16_t) contrast * rows_count)/SSD1306_ROWS;
+
+	return 2;
+}
+
+static uint8_t display_mode_cmds(uint8_t *cmds, disp_mode_t mode)
+{
+	cmds[0] = REG_DISP_MODE | ((mode == DISP_MODE_NORMAL) ? 0 : 1);
+
+	return 1;
+}
+
+static uint8_t power_mode_cmds(uint8_t *cmds, pwr_mode_t mode)
+{
+	switch (mode) {
+		case PWR_MODE_SLEEP:
+			cmds[0] = REG_DISP_EN | 0;
+			cmds[1] = REG_CHRG_PUMP;
+			cmds[2] = 0x10;
+			break;
+
+		default:
+		case PWR_MODE_ON:
+			cmds[0] = REG_CHRG_PUMP;
+			cmds[1] = 0x14;
+			cmds[2] = REG_DISP_EN | 1;
+			break;
+	}
+
+	return 3;
+}
+
+static void init_job_fn(job_t *job)
+{
+	uint8_t cmds[sizeof(init_cmds) + 11];
+	uint8_t length = 0;
+
+	/* Configuration, along with the settings requested meanwhile */
+	length += rows_cmds(&cmds[length]);
+	memcpy(&cmds[length], init_cmds, sizeof(init_cmds));
+	length += sizeof(init_cmds);
+	length += contrast_cmds(&cmds[length]);
+	length += display_mode_cmds(&cmds[length], disp_mode);
+	length += power_mode_cmds(&cmds[length], pwr_mode);
+	ssd1306_send_cmds(cmds, length);
+
+	ready = 1;
+
+	if (ready_cb != NULL) {
+		ready_cb();
+	}
+}
+
+void ssd1306_init(void (*cb)(void))
 {
 	spi_init();
 
+	ready_cb = cb;
+	ready = 0;
+
+	job_set_name(&init_job, "disp");
+
 	/* Power-up sequence */
 	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
@@ -41,90 +154,128 @@ void ssd1306_init(void)
 	gpio_set(BOARD_SCREEN_RST_PORT, BOARD_SCREEN_RST_PIN);
 	gpio_set(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
-	time_delay(MS_TO_MCU_TIME(10));
-
-	/* Configuration */
-	ssd1306_send_cmd_2b(REG_MUX_RATIO, 0x3F);
-	ssd1306_send_cmd_2b(REG_DISP_OFFSET, 0x00);
-	ssd1306_send_cmd_1b(REG_DISP_START_LINE, 0);
-	ssd1306_send_cmd_1b(REG_SEG_REMAP, 0);
-	ssd1306_send_cmd_2b(REG_COM_PINS_CFG, 0x12);
-	ssd1306_send_cmd_1b(REG_COM_SCAN_DIR, 0);
 
-	ssd1306_send_cmd_2b(REG_CONTRAST, 0x7F);
-	ssd1306_send_cmd_2b(REG_MEM_ADDR_MODE, MEM_ADDR_MODE_H);
-	ssd1306_send_cmd_3b(REG_COL_ADDR, 0x00, 0x7F);
-	ssd1306_send_cmd_3b(REG_PAGE_ADDR, 0x00, 0x07);
+	/* The boot goes on while the screen powers up */
+	ready_time = time_get() + MS_TO_MCU_TIME(POWER_UP_MS);
+	job_schedule(&init_job, &init_job_fn, ready_time);
+}
 
-	ssd1306_send_cmd_1b(REG_DISP_MODE, 0);
-	ssd1306_send_cmd_2b(REG_VCOMH_LVL, 0x00);
+void ssd1306_wait_ready(void)
+{
+	if (ready) {
+		return;
+	}
 
-	ssd1306_send_cmd_1b(REG_DISP_ON, 0);
-	ssd1306_send_cmd_2b(REG_DISP_CLK_CFG, 0x80);
-	ssd1306_send_cmd_2b(REG_CHRG_PUMP, 0x14);
-	ssd1306_send_cmd_1b(REG_DISP_EN, 1);
+	/* Finish the power-up now instead of waiting for the job */
+	job_cancel(&init_job);
+	time_wait_until(ready_time);
+	init_job_fn(&init_job);
 }
 
 void ssd1306_set_display_mode(disp_mode_t mode)
 {
-	ssd1306_send_cmd_1b(REG_DISP_MODE, (mode == DISP_MODE_NORMAL) ? 0 : 1);
+	uint8_t cmds[1];
+
+	disp_mode = mode;
+
+	if (ready) {
+		ssd1306_send_cmds(cmds, display_mode_cmds(cmds, mode));
+	}
 }
 
 void ssd1306_set_power_mode(pwr_mode_t mode)
 {
-	switch (mode) {
-		case PWR_MODE_SLEEP:
-			ssd1306_send_cmd_1b(REG_DISP_EN, 0);
-			ssd1306_send_cmd_2b(REG_CHRG_PUMP, 0x10);
-			break;
+	uint8_t cmds[3];
 
-		case PWR_MODE_ON:
-			ssd1306_send_cmd_2b(REG_CHRG_PUMP, 0x14);
-			ssd1306_send_cmd_1b(REG_DISP_EN, 1);
-			break;
+	pwr_mode = mode;
+
+	if (ready) {
+		ssd1306_send_cmds(cmds, power_mode_cmds(cmds, mode));
 	}
 }
 
-void ssd1306_send_cmd_1b(uint8_t reg, uint8_t data)
+void ssd1306_set_contrast(uint8_t c)
 {
-	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
-	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	uint8_t cmds[2];
 
-	spi_write(reg | data);
-	time_delay(US_TO_MCU_TIME(1));
+	contrast = c;
 
-	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	if (ready) {
+		ssd1306_send_cmds(cmds, contrast_cmds(cmds));
+	}
 }
 
-void ssd1306_send_cmd_2b(uint8_t reg, uint8_t data)
+void ssd1306_set_rows(uint8_t first, uint8_t count)
 {
-	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
-	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	uint8_t cmds[7];
+	uint8_t length;
 
-	spi_write(reg);
-	spi_write(data);
-	time_delay(US_TO_MCU_TIME(1));
+	if (count < SSD1306_ROWS_MIN) {
+		count = SSD1306_ROWS_MIN;
+	}
 
-	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	if (first + count > SSD1306_ROWS) {
+		first = SSD1306_ROWS - count;
+	}
+
+	if (first == rows_first && count == rows_count) {
+		return;
+	}
+
+	rows_first = first;
+	rows_count = count;
+
+	if (ready) {
+		length = rows_cmds(cmds);
+		length += contrast_cmds(&cmds[length]);
+		ssd1306_send_cmds(cmds, length);
+	}
 }
 
-void ssd1306_send_cmd_3b(uint8_t reg, uint8_t data1, uint8_t data2)
+void ssd1306_send_cmds(const uint8_t *cmds, uint16_t length)
 {
+	uint16_t i;
+
+	spi_wait();
+
 	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 
-	spi_write(reg);
-	spi_write(data1);
-	spi_write(data2);
+	for (i = 0; i < length; i++) {
+		spi_write(cmds[i]);
+	}
 	time_delay(US_TO_MCU_TIME(1));
 
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 }
 
+void ssd1306_send_cmd_1b(uint8_t reg, uint8_t data)
+{
+	uint8_t cmds[] = {reg | data};
+
+	ssd1306_send_cmds(cmds, sizeof(cmds));
+}
+
+void ssd1306_send_cmd_2b(uint8_t reg, uint8_t data)
+{
+	uint8_t cmds[] = {reg, data};
+
+	ssd1306_send_cmds(cmds, sizeof(cmds));
+}
+
+void ssd1306_send_cmd_3b(uint8_t reg, uint8_t data1, uint8_t data2)
+{
+	uint8_t cmds[] = {reg, data1, data2};
+
+	ssd1306_send_cmds(cmds, sizeof(cmds));
+}
+
 void ssd1306_send_data(uint8_t *data, uint16_t length)
 {
 	uint16_t i;
 
+	spi_wait();
+
 	gpio_set(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 
@@ -135,3 +286,34 @@ void ssd1306_send_data(uint8_t *data, uint16_t length)
 
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 }
+
+static void window_sent(void)
+{
+	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+
+	window_cb();
+}
+
+void ssd1306_send_window(uint8_t *data, uint8_t page, uint8_t col_start, uint8_t col_end)
+{
+	uint8_t cmds[] = {REG_COL_ADDR, col_start, col_end, REG_PAGE_ADDR, page, page};
+
+	/* The horizontal addressing mode wraps inside the window */
+	ssd1306_send_cmds(cmds, sizeof(cmds));
+
+	if (window_cb == NULL) {
+		ssd1306_send_data(data, col_end - col_start + 1);
+		return;
+	}
+
+	/* The data is sent by DMA, any other transfer waiting for its end */
+	gpio_set(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
+	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+
+	spi_write_dma(data, col_end - col_start + 1, &window_sent);
+}
+
+void ssd1306_register_window_cb(void (*cb)(void))
+{
+	window_cb = cb;
+}
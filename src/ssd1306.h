@@ -22,6 +22,10 @@
 
 #include <stdint.h>
 
+#define SSD1306_ROWS					64
+#define SSD1306_ROWS_MIN				16
+#define SSD1306_CONTRAST_DEFAULT			0x7F
+
 #define REG_CONTRAST					0x81
 #define REG_DISP_ON					0xA4
 #define REG_DISP_MODE					0xA6
@@ -59,15 +63,35 @@ typedef enum{
 } pwr_mode_t;
 
 
-void ssd1306_init(void);
+/* The last power-up wait is a job, cb being called once the screen is
+ * configured. The modes set meanwhile are applied at that point.
+ */
+void ssd1306_init(void (*cb)(void));
+
+/* Blocks until the end of the power-up, calling cb if not done yet */
+void ssd1306_wait_ready(void);
 
 void ssd1306_set_display_mode(disp_mode_t mode);
 void ssd1306_set_power_mode(pwr_mode_t mode);
+void ssd1306_set_contrast(uint8_t contrast);
 
+/* Only the given rows are driven, the other ones being turned off. The
+ * contrast is scaled so that the brightness does not change.
+ */
+void ssd1306_set_rows(uint8_t first, uint8_t count);
+
+/* The whole sequence is sent within a single chip select */
+void ssd1306_send_cmds(const uint8_t *cmds, uint16_t length);
 void ssd1306_send_cmd_1b(uint8_t reg, uint8_t data);
 void ssd1306_send_cmd_2b(uint8_t reg, uint8_t data);
 void ssd1306_send_cmd_3b(uint8_t reg, uint8_t data1, uint8_t data2);
 
 void ssd1306_send_data(uint8_t *data, uint16_t length);
+void ssd1306_send_window(uint8_t *data, uint8_t page, uint8_t col_start, uint8_t col_end);
+
+/* Once a callback is registered, the windows are sent in the background and
+ * the callback is called from IRQ context when each of them has been sent
+ */
+void ssd1306_register_window_cb(void (*cb)(void));
 
 #endif /* _SSD1306_H_ */
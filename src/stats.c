@@ -0,0 +1,177 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ff_gen_drv.h"
+
+#include "time.h"
+#include "system.h"
+#include "job.h"
+#include "stats.h"
+
+#ifdef JOB_STATS
+
+#define STATS_FILE_NAME					"stats.txt"
+#define STATS_LINE_SIZE					64
+
+static char stats_line[STATS_LINE_SIZE];
+
+static const char *state_names[STATE_NUM] = {"run", "sleep1", "sleep2", "sleep3"};
+
+
+static char * append_str(char *ptr, const char *str, uint8_t width)
+{
+	uint8_t len = 0;
+
+	while (str[len] != '\0') {
+		*(ptr++) = str[len++];
+	}
+
+	/* Left-aligned */
+	while (len++ < width) {
+		*(ptr++) = ' ';
+	}
+
+	return ptr;
+}
+
+static char * append_uint(char *ptr, uint32_t v, uint8_t width)
+{
+	char digits[10];
+	uint8_t len = 0;
+
+	do {
+		digits[len++] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0);
+
+	/* Right-aligned */
+	while (width-- > len) {
+		*(ptr++) = ' ';
+	}
+
+	while (len > 0) {
+		*(ptr++) = digits[--len];
+	}
+
+	return ptr;
+}
+
+static int8_t write_line(FIL *f, char *end)
+{
+	UINT num;
+
+	*(end++) = '\n';
+
+	if (f_write(f, stats_line, end - stats_line, &num) || (num < (UINT) (end - stats_line))) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int8_t stats_dump(void)
+{
+	FIL f;
+	job_t *j = NULL;
+	const job_sleep_stats_t *s;
+	mcu_time_t elapsed;
+	uint8_t i;
+	char *ptr;
+
+	if (f_open(&f, STATS_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE)) {
+		/* Error */
+		return -1;
+	}
+
+	/* One line per job, all times in us */
+	ptr = stats_line;
+	ptr = append_str(ptr, "job", 8);
+	ptr = append_str(ptr, "      runs", 0);
+	ptr = append_str(ptr, "  late_avg  late_max", 0);
+	ptr = append_str(ptr, "   run_avg   run_max", 0);
+
+	if (write_line(&f, ptr) < 0) {
+		/* Error */
+		f_close(&f);
+		return -1;
+	}
+
+	while ((j = job_stats_get_next(j)) != NULL) {
+		ptr = stats_line;
+		ptr = append_str(ptr, j->name, 8);
+		ptr = append_uint(ptr, j->stats.runs, 10);
+		ptr = append_uint(ptr, (j->stats.runs > 0) ? MCU_TIME_TO_US((uint64_t) j->stats.late_total)/j->stats.runs : 0, 10);
+		ptr = append_uint(ptr, MCU_TIME_TO_US((uint64_t) j->stats.late_max), 10);
+		ptr = append_uint(ptr, (j->stats.runs > 0) ? MCU_TIME_TO_US((uint64_t) j->stats.run_total)/j->stats.runs : 0, 10);
+		ptr = append_uint(ptr, MCU_TIME_TO_US((uint64_t) j->stats.run_max), 10);
+
+		if (write_line(&f, ptr) < 0) {
+			/* Error */
+			f_close(&f);
+			return -1;
+		}
+	}
+
+	/* Then the wakeups and the time spent in each low-power state, in ms and per mille */
+	s = job_stats_get_sleep();
+	elapsed = time_get() - s->since;
+
+	ptr = stats_line;
+	ptr = append_str(ptr, "\n", 0);
+	ptr = append_str(ptr, "wakeups", 8);
+	ptr = append_uint(ptr, s->wakeups, 10);
+	ptr = append_str(ptr, " in ", 0);
+	ptr = append_uint(ptr, MCU_TIME_TO_US((uint64_t) elapsed)/1000, 0);
+	ptr = append_str(ptr, " ms", 0);
+
+	if (write_line(&f, ptr) < 0) {
+		/* Error */
+		f_close(&f);
+		return -1;
+	}
+
+	for (i = STATE_SLEEP_S1; i < STATE_NUM; i++) {
+		ptr = stats_line;
+		ptr = append_str(ptr, state_names[i], 8);
+		ptr = append_uint(ptr, MCU_TIME_TO_US((uint64_t) s->residency[i])/1000, 10);
+		ptr = append_uint(ptr, (elapsed > 0) ? (s->residency[i] * 1000ULL)/elapsed : 0, 10);
+
+		if (write_line(&f, ptr) < 0) {
+			/* Error */
+			f_close(&f);
+			return -1;
+		}
+	}
+
+	f_close(&f);
+
+	return 0;
+}
+
+#else
+
+int8_t stats_dump(void)
+{
+	return -1;
+}
+
+#endif
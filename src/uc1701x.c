@@ -18,17 +18,97 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "time.h"
 #include "spi.h"
 #include "gpio.h"
 #include "board.h"
+#include "job.h"
 #include "uc1701x.h"
 
-void uc1701x_init(void)
+#define POWER_UP_MS					120
+
+static void (*window_cb)(void) = NULL;
+
+static job_t init_job;
+static mcu_time_t ready_time;
+static void (*ready_cb)(void) = NULL;
+static uint8_t ready = 0;
+
+/* Applied once the screen is ready */
+static disp_mode_t disp_mode = DISP_MODE_NORMAL;
+static pwr_mode_t pwr_mode = PWR_MODE_ON;
+
+static const uint8_t power_up_cmds[] = {
+	REG_RESET,
+	REG_POWER_CTRL | POWER_CTRL_BOOST | POWER_CTRL_V_REG | POWER_CTRL_V_FOL,
+	REG_ADV_PRG_CTRL0 | 0x93,
+	REG_SCROLL_LINE | 0,
+	REG_SEG_DIR | 1,
+	REG_COM_DIR | 0,
+};
+
+static const uint8_t config_cmds[] = {
+	REG_LCD_BIAS_RATIO | 0,
+	REG_ELEC_VOLUME, 50,
+	REG_VLCD_RES_RATIO | 3,
+};
+
+
+static uint8_t display_mode_cmds(uint8_t *cmds, disp_mode_t mode)
+{
+	cmds[0] = REG_INV_DISP | ((mode == DISP_MODE_NORMAL) ? 0 : 1);
+
+	return 1;
+}
+
+static uint8_t power_mode_cmds(uint8_t *cmds, pwr_mode_t mode)
+{
+	switch (mode) {
+		case PWR_MODE_SLEEP:
+			cmds[0] = REG_DISP_EN | 0;
+			cmds[1] = REG_ALL_PIX_ON | 1;
+			break;
+
+		default:
+		case PWR_MODE_ON:
+			cmds[0] = REG_ALL_PIX_ON | 0;
+			cmds[1] = REG_DISP_EN | 1;
+			break;
+	}
+
+	return 2;
+}
+
+static void init_job_fn(job_t *job)
+{
+	uint8_t cmds[sizeof(config_cmds) + 3];
+	uint8_t length = sizeof(config_cmds);
+
+	/* Configuration, along with the modes requested meanwhile */
+	memcpy(cmds, config_cmds, sizeof(config_cmds));
+	length += display_mode_cmds(&cmds[length], disp_mode);
+	length += power_mode_cmds(&cmds[length], pwr_mode);
+	uc1701x_send_cmds(cmds, length);
+
+	ready = 1;
+
+	if (ready_cb != NULL) {
+		ready_cb();
+	}
+}
+
+void uc1701x_init(void (*cb)(void))
 {
 	spi_init();
 
+	ready_cb = cb;
+	ready = 0;
+
+	job_set_name(&init_job, "disp");
+
 	/* Power-up sequence */
 	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
@@ -38,61 +118,76 @@ void uc1701x_init(void)
 	time_delay(MS_TO_MCU_TIME(5));
 	gpio_set(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 
-	/* Configuration */
-	uc1701x_send_cmd_1b(REG_RESET, 0);
-	uc1701x_send_cmd_1b(REG_POWER_CTRL, POWER_CTRL_BOOST | POWER_CTRL_V_REG | POWER_CTRL_V_FOL);
-	uc1701x_send_cmd_1b(REG_ADV_PRG_CTRL0, 0x93);
-	uc1701x_send_cmd_1b(REG_SCROLL_LINE, 0);
-	uc1701x_send_cmd_1b(REG_SEG_DIR, 1);
-	uc1701x_send_cmd_1b(REG_COM_DIR, 0);
-
-	time_delay(MS_TO_MCU_TIME(120));
-	uc1701x_send_cmd_1b(REG_LCD_BIAS_RATIO, 0);
-	uc1701x_send_cmd_2b(REG_ELEC_VOLUME, 50);
-	uc1701x_send_cmd_1b(REG_VLCD_RES_RATIO, 3);
+	uc1701x_send_cmds(power_up_cmds, sizeof(power_up_cmds));
+
+	/* The boot goes on while the booster and regulators settle */
+	ready_time = time_get() + MS_TO_MCU_TIME(POWER_UP_MS);
+	job_schedule(&init_job, &init_job_fn, ready_time);
+}
+
+void uc1701x_wait_ready(void)
+{
+	if (ready) {
+		return;
+	}
+
+	/* Finish the power-up now instead of waiting for the job */
+	job_cancel(&init_job);
+	time_wait_until(ready_time);
+	init_job_fn(&init_job);
 }
 
 void uc1701x_set_display_mode(disp_mode_t mode)
 {
-	uc1701x_send_cmd_1b(REG_INV_DISP, (mode == DISP_MODE_NORMAL) ? 0 : 1);
+	uint8_t cmds[1];
+
+	disp_mode = mode;
+
+	if (ready) {
+		uc1701x_send_cmds(cmds, display_mode_cmds(cmds, mode));
+	}
 }
 
 void uc1701x_set_power_mode(pwr_mode_t mode)
 {
-	switch (mode) {
-		case PWR_MODE_SLEEP:
-			uc1701x_send_cmd_1b(REG_DISP_EN, 0);
-			uc1701x_send_cmd_1b(REG_ALL_PIX_ON, 1);
-			break;
+	uint8_t cmds[2];
 
-		case PWR_MODE_ON:
-			uc1701x_send_cmd_1b(REG_ALL_PIX_ON, 0);
-			uc1701x_send_cmd_1b(REG_DISP_EN, 1);
-			break;
+	pwr_mode = mode;
+
+	if (ready) {
+		uc1701x_send_cmds(cmds, power_mode_cmds(cmds, mode));
 	}
 }
 
-void uc1701x_send_cmd_1b(uint8_t reg, uint8_t data)
+void uc1701x_send_cmds(const uint8_t *cmds, uint16_t length)
 {
+	uint16_t i;
+
+	spi_wait();
+
 	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
 	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 
-	spi_write(reg | data);
+	for (i = 0; i < length; i++) {
+		spi_write(cmds[i]);
+	}
 	time_delay(US_TO_MCU_TIME(1));
 
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 }
 
-void uc1701x_send_cmd_2b(uint8_t reg, uint8_t data)
+void uc1701x_send_cmd_1b(uint8_t reg, uint8_t data)
 {
-	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
-	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	uint8_t cmds[] = {reg | data};
 
-	spi_write(reg);
-	spi_write(data);
-	time_delay(US_TO_MCU_TIME(1));
+	uc1701x_send_cmds(cmds, sizeof(cmds));
+}
 
-	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+void uc1701x_send_cmd_2b(uint8_t reg, uint8_t data)
+{
+	uint8_t cmds[] = {reg, data};
+
+	uc1701x_send_cmds(cmds, sizeof(cmds));
 }
 
 void uc1701x_send_data(uint8_t *data, uint16_t length)
@@ -101,6 +196,8 @@ void uc1701x_send_data(uint8_t *data, uint16_t length)
 	uint16_t page = 0;
 	uint16_t block_len;
 
+	spi_wait();
+
 	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 
 	while (length > 0) {
@@ -132,3 +229,48 @@ void uc1701x_send_data(uint8_t *data, uint16_t length)
 
 	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
 }
+
+static void window_sent(void)
+{
+	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+
+	window_cb();
+}
+
+void uc1701x_send_window(uint8_t *data, uint8_t page, uint8_t col_start, uint8_t col_end)
+{
+	uint16_t i;
+	uint8_t col = col_start + 4; // Same shift as in uc1701x_send_data()
+
+	spi_wait();
+
+	gpio_clear(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+	gpio_clear(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
+
+	spi_write(REG_PAGE_ADDR | page);
+	spi_write(REG_COL_ADDR_LSB | (col & 0xF));
+	spi_write(REG_COL_ADDR_MSB | (col >> 4));
+
+	time_delay(US_TO_MCU_TIME(1));
+
+	gpio_set(BOARD_SCREEN_DC_PORT, BOARD_SCREEN_DC_PIN);
+
+	if (window_cb != NULL) {
+		/* The data is sent by DMA, any other transfer waiting for its end */
+		spi_write_dma(data, col_end - col_start + 1, &window_sent);
+		return;
+	}
+
+	for (i = col_start; i <= col_end; i++) {
+		spi_write(*(data++));
+	}
+
+	time_delay(US_TO_MCU_TIME(1));
+
+	gpio_set(BOARD_SCREEN_NSS_PORT, BOARD_SCREEN_NSS_PIN);
+}
+
+void uc1701x_register_window_cb(void (*cb)(void))
+{
+	window_cb = cb;
+}
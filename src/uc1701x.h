@@ -54,14 +54,28 @@ typedef enum{
 } pwr_mode_t;
 
 
-void uc1701x_init(void);
+/* The last power-up wait is a job, cb being called once the screen is
+ * configured. The modes set meanwhile are applied at that point.
+ */
+void uc1701x_init(void (*cb)(void));
+
+/* Blocks until the end of the power-up, calling cb if not done yet */
+void uc1701x_wait_ready(void);
 
 void uc1701x_set_display_mode(disp_mode_t mode);
 void uc1701x_set_power_mode(pwr_mode_t mode);
 
+/* The whole sequence is sent within a single chip select */
+void uc1701x_send_cmds(const uint8_t *cmds, uint16_t length);
 void uc1701x_send_cmd_1b(uint8_t reg, uint8_t data);
 void uc1701x_send_cmd_2b(uint8_t reg, uint8_t data);
 
 void uc1701x_send_data(uint8_t *data, uint16_t length);
+void uc1701x_send_window(uint8_t *data, uint8_t page, uint8_t col_start, uint8_t col_end);
+
+/* Once a callback is registered, the windows are sent in the background and
+ * the callback is called from IRQ context when each of them has been sent
+ */
+void uc1701x_register_window_cb(void (*cb)(void));
 
 #endif /* _UC1701X_H_ */
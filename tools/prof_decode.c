@@ -0,0 +1,144 @@
+/*
+ * MCUGotchi - A Tamagotchi P1 emulator for microcontrollers
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "prof.h"
+
+/* Host-side decoder of the prof.bin file written by the profiler (see
+ * prof.h), printing where the emulated CPU spends its time: halted, in
+ * the interrupt handlers, and in the hottest ROM address ranges.
+ */
+
+#define DEFAULT_TOP_NUM					16
+
+typedef struct {
+	uint16_t bucket;
+	uint16_t count;
+} entry_t;
+
+static uint16_t get_u16(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *ptr)
+{
+	return get_u16(ptr) | ((uint32_t) get_u16(ptr + 2) << 16);
+}
+
+static int cmp_entries(const void *a, const void *b)
+{
+	const entry_t *ea = a, *eb = b;
+
+	if (ea->count != eb->count) {
+		return (ea->count < eb->count) ? 1 : -1;
+	}
+
+	return (ea->bucket > eb->bucket) ? 1 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t header[PROF_HEADER_SIZE];
+	uint8_t buf[2];
+	entry_t *entries;
+	uint16_t bucket_num, i, n = 0;
+	uint8_t shift;
+	uint32_t period, samples, halt_samples, int_samples, run_samples;
+	unsigned long top = DEFAULT_TOP_NUM;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <prof.bin> [top]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 2) {
+		top = strtoul(argv[2], NULL, 0);
+	}
+
+	f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s !\n", argv[1]);
+		return 1;
+	}
+
+	if (fread(header, 1, PROF_HEADER_SIZE, f) != PROF_HEADER_SIZE || memcmp(header, PROF_MAGIC, 4) || header[4] != PROF_VERSION) {
+		fprintf(stderr, "%s is not a supported profile !\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+
+	shift = header[5];
+	bucket_num = get_u16(&header[6]);
+	period = get_u32(&header[8]);
+	samples = get_u32(&header[12]);
+	halt_samples = get_u32(&header[16]);
+	int_samples = get_u32(&header[20]);
+	run_samples = samples - halt_samples;
+
+	entries = malloc(bucket_num * sizeof(entry_t));
+	if (entries == NULL) {
+		fclose(f);
+		return 1;
+	}
+
+	for (i = 0; i < bucket_num && fread(buf, 1, 2, f) == 2; i++) {
+		if (get_u16(buf) > 0) {
+			entries[n].bucket = i;
+			entries[n].count = get_u16(buf);
+			n++;
+		}
+	}
+
+	fclose(f);
+
+	printf("samples\t%u (every %u ms)\n", samples, period);
+	if (samples == 0) {
+		free(entries);
+		return 0;
+	}
+
+	printf("halt\t%.2f%%\n", (double) halt_samples * 100/samples);
+	printf("running\t%.2f%%\n", (double) run_samples * 100/samples);
+	printf("int\t%.2f%%\n", (double) int_samples * 100/samples);
+
+	if (run_samples == 0) {
+		free(entries);
+		return 0;
+	}
+
+	/* Hottest ranges first, in % of the time the CPU is running */
+	qsort(entries, n, sizeof(entry_t), &cmp_entries);
+
+	printf("\nrange\t\tpct\tcumul\n");
+	for (i = 0, samples = 0; i < n && i < top; i++) {
+		samples += entries[i].count;
+		printf("0x%03X-0x%03X\t%.2f\t%.2f\n", entries[i].bucket << shift, ((entries[i].bucket + 1) << shift) - 1,
+			(double) entries[i].count * 100/run_samples, (double) samples * 100/run_samples);
+	}
+
+	free(entries);
+
+	return 0;
+}